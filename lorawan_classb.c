@@ -0,0 +1,220 @@
+//  Class B Beacon Tracking for LoRaWAN Test App.
+//  The Beacon arrival times are taken when the Beacon Callback runs in the
+//  Event Loop, so the Event Loop latency appears as jitter. The drift is
+//  smoothed across Beacons and the jitter is covered by the RX timing error.
+#include <nuttx/config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lorawan_classb.h"
+
+/// Limits for the maximum RX timing error (milliseconds)
+#define MIN_RX_ERROR_MS  5
+#define MAX_RX_ERROR_MS  200
+
+/// Minimum number of symbols to detect the preamble in a Ping Slot
+#define MIN_RX_SYMBOLS  6
+
+/// Weight of a new sample in the moving averages: 1 / 2^AVG_SHIFT
+#define AVG_SHIFT  2
+
+/// Class B statistics
+struct classb_stats_s {
+    bool     acquiring;         //  True if waiting for the first Beacon
+    bool     synced;            //  True if a Beacon has been received
+    uint64_t request_time;      //  Time of Beacon acquisition request (microseconds)
+    uint32_t acq_latency;       //  Beacon acquisition latency (milliseconds)
+    uint32_t last_beacon_time;  //  GPS time of the last received Beacon (seconds)
+    uint64_t last_rx_time;      //  Local time of the last received Beacon (microseconds)
+    uint32_t drift_samples;     //  Number of drift samples
+    int32_t  drift_ppb;         //  Smoothed drift of the local clock (parts per billion)
+    uint32_t jitter_us;         //  Smoothed arrival time jitter after removing drift (microseconds)
+    uint32_t beacons_rx;        //  Beacons received
+    uint32_t beacons_missed;    //  Beacons missed
+    uint32_t beacons_lost;      //  Times Class B was stopped because Beacons were lost
+    uint32_t consecutive_missed;  //  Beacons missed since the last received Beacon
+    uint32_t base_rx_error_us;  //  RX timing error from drift and jitter (microseconds)
+    uint32_t rx_error_ms;       //  Maximum RX timing error, widened for missed Beacons (milliseconds)
+    uint8_t  periodicity;       //  Ping Slot Periodicity
+    uint8_t  dr;                //  Datarate of the last received Beacon
+    uint32_t ping_slots;        //  Ping Slots opened
+    uint32_t ping_hits;         //  Downlinks received in Ping Slots
+    uint32_t modelled_slots;    //  Ping Slots at a datarate with a known SF and bandwidth
+    uint32_t unmodelled_slots;  //  Ping Slots at a datarate that is not modelled (FSK, LR-FHSS, RFU)
+    uint64_t radio_on_us;       //  Estimated radio-on time in the modelled Ping Slots (microseconds)
+    uint32_t init_rx_error_ms;  //  Initial maximum RX timing error (milliseconds)
+};
+
+static struct classb_stats_s classb;
+
+/// Return the number of Ping Slots per Beacon Period
+static uint32_t slots_per_period(void) {
+    return LORAWAN_CLASSB_BEACON_PERIOD >> classb.periodicity;
+}
+
+/// Spreading Factor and bandwidth (kHz) of each LoRa datarate in the active region, from the
+/// LoRaWAN Regional Parameters. 0 marks datarates that are not LoRa (FSK, LR-FHSS) or are RFU:
+/// their radio-on time is not estimated.
+#if defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_US915)
+static const uint8_t  dr_sf[]      = { 10, 9, 8, 7, 8, 0, 0, 0, 12, 11, 10, 9, 8, 7 };
+static const uint16_t dr_bw_khz[]  = { 125, 125, 125, 125, 500, 0, 0, 0, 500, 500, 500, 500, 500, 500 };
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_AU915)
+static const uint8_t  dr_sf[]      = { 12, 11, 10, 9, 8, 7, 8, 0, 12, 11, 10, 9, 8, 7 };
+static const uint16_t dr_bw_khz[]  = { 125, 125, 125, 125, 125, 125, 500, 0, 500, 500, 500, 500, 500, 500 };
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_CN470)
+static const uint8_t  dr_sf[]      = { 12, 11, 10, 9, 8, 7, 7 };
+static const uint16_t dr_bw_khz[]  = { 125, 125, 125, 125, 125, 125, 500 };
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_IN865) || defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_KR920)
+static const uint8_t  dr_sf[]      = { 12, 11, 10, 9, 8, 7 };
+static const uint16_t dr_bw_khz[]  = { 125, 125, 125, 125, 125, 125 };
+#else
+//  AS923, CN779, EU433, EU868, RU864
+static const uint8_t  dr_sf[]      = { 12, 11, 10, 9, 8, 7, 7 };
+static const uint16_t dr_bw_khz[]  = { 125, 125, 125, 125, 125, 125, 250 };
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_REGION_US915
+
+/// Return the estimated radio-on time of one Ping Slot (microseconds): the RX window
+/// opens early and closes late by the RX timing error, and stays open for the
+/// preamble symbols. Returns 0 if the datarate is not modelled for the region.
+static uint32_t slot_radio_on(void) {
+    if (classb.dr >= sizeof(dr_sf) || dr_sf[classb.dr] == 0) { return 0; }
+    uint32_t symbol_us = ((uint32_t) 1 << dr_sf[classb.dr]) * 1000 / dr_bw_khz[classb.dr];  //  2^SF / BW
+    return 2 * classb.rx_error_ms * 1000 + MIN_RX_SYMBOLS * symbol_us;
+}
+
+/// Count the Ping Slots opened in one Beacon Period
+static void count_ping_slots(void) {
+    uint32_t slots = slots_per_period();
+    uint32_t radio_on = slot_radio_on();
+    classb.ping_slots += slots;
+    if (radio_on == 0) {
+        classb.unmodelled_slots += slots;
+        return;
+    }
+    classb.modelled_slots += slots;
+    classb.radio_on_us    += (uint64_t) slots * radio_on;
+}
+
+/// Compute the maximum RX timing error from the drift and jitter, widened by the missed Beacons.
+/// Keeps the initial RX timing error until the drift has been measured.
+static uint32_t update_rx_error(void) {
+    if (classb.drift_samples == 0) { return classb.rx_error_ms; }
+
+    //  The drift accumulates over one Beacon Period. Allow 3 times the jitter.
+    uint32_t drift_us = (uint32_t) ((uint64_t) abs(classb.drift_ppb) * LORAWAN_CLASSB_BEACON_PERIOD / 1000);
+    classb.base_rx_error_us = drift_us + 3 * classb.jitter_us;
+    uint32_t error_ms = (classb.base_rx_error_us + 999) / 1000;
+    if (error_ms < MIN_RX_ERROR_MS) { error_ms = MIN_RX_ERROR_MS; }
+
+    //  Each missed Beacon adds another Beacon Period of uncertainty
+    error_ms *= 1 + classb.consecutive_missed;
+    if (error_ms > MAX_RX_ERROR_MS) { error_ms = MAX_RX_ERROR_MS; }
+    classb.rx_error_ms = error_ms;
+    return error_ms;
+}
+
+/// Clear the Class B statistics. "rx_error_ms" is the initial maximum RX timing error.
+void lorawan_classb_init(uint32_t rx_error_ms) {
+    memset(&classb, 0, sizeof(classb));
+    classb.rx_error_ms      = rx_error_ms;
+    classb.init_rx_error_ms = rx_error_ms;
+}
+
+/// Set the Ping Slot Periodicity (0 to 7): one Ping Slot every 2^periodicity seconds
+void lorawan_classb_set_periodicity(uint8_t periodicity) {
+    classb.periodicity = (periodicity > 7) ? 7 : periodicity;
+}
+
+/// Start Beacon acquisition at the time "now" (microseconds)
+void lorawan_classb_request(uint64_t now) {
+    classb.acquiring    = true;
+    classb.synced       = false;
+    classb.request_time = now;
+}
+
+/// Handle a received Beacon with GPS time "beacon_time" (seconds) at the local time
+/// "now" (microseconds) and datarate "dr". Returns the new maximum RX timing error (milliseconds).
+uint32_t lorawan_classb_beacon_rx(uint32_t beacon_time, uint64_t now, uint8_t dr) {
+    if (classb.acquiring) {
+        classb.acquiring   = false;
+        classb.acq_latency = (uint32_t) ((now - classb.request_time) / 1000);
+    }
+
+    //  Compare the local time elapsed with the GPS time elapsed since the last Beacon
+    if (classb.synced && beacon_time > classb.last_beacon_time) {
+        int64_t expected_us = (int64_t) (beacon_time - classb.last_beacon_time) * 1000000;
+        int64_t error_us = (int64_t) (now - classb.last_rx_time) - expected_us;
+        int32_t sample_ppb = (int32_t) (error_us * 1000000000 / expected_us);
+
+        if (classb.drift_samples == 0) {
+            classb.drift_ppb = sample_ppb;
+        } else {
+            classb.drift_ppb += (sample_ppb - classb.drift_ppb) / (1 << AVG_SHIFT);
+        }
+        classb.drift_samples++;
+
+        //  Jitter is the error left after removing the drift
+        int64_t residual_us = error_us - (int64_t) classb.drift_ppb * expected_us / 1000000000;
+        uint32_t abs_residual = (uint32_t) (residual_us < 0 ? -residual_us : residual_us);
+        classb.jitter_us += ((int32_t) abs_residual - (int32_t) classb.jitter_us) / (1 << AVG_SHIFT);
+    }
+
+    classb.synced             = true;
+    classb.last_beacon_time   = beacon_time;
+    classb.last_rx_time       = now;
+    classb.dr                 = dr;
+    classb.consecutive_missed = 0;
+    classb.beacons_rx++;
+    uint32_t rx_error = update_rx_error();
+    count_ping_slots();
+    return rx_error;
+}
+
+/// Handle a missed Beacon. Returns the new maximum RX timing error (milliseconds).
+uint32_t lorawan_classb_beacon_missed(void) {
+    //  The MAC keeps opening Ping Slots during beacon-less operation
+    classb.beacons_missed++;
+    classb.consecutive_missed++;
+    uint32_t rx_error = update_rx_error();
+    count_ping_slots();
+    return rx_error;
+}
+
+/// Handle a lost Beacon at the local time "now" (microseconds): Class B has stopped and the
+/// MAC restarts Beacon acquisition. The drift is measured again from the next Beacon, so the
+/// RX timing error goes back to the initial value. Returns the initial maximum RX timing error (milliseconds).
+uint32_t lorawan_classb_beacon_lost(uint64_t now) {
+    classb.beacons_lost++;
+    classb.synced             = false;
+    classb.acquiring          = true;
+    classb.request_time       = now;
+    classb.drift_samples      = 0;
+    classb.drift_ppb          = 0;
+    classb.jitter_us          = 0;
+    classb.consecutive_missed = 0;
+    classb.base_rx_error_us   = 0;
+    classb.rx_error_ms        = classb.init_rx_error_ms;
+    return classb.rx_error_ms;
+}
+
+/// Count a downlink received in a Ping Slot
+void lorawan_classb_ping_rx(void) {
+    classb.ping_hits++;
+}
+
+/// Print the Class B statistics as one line of JSON
+void lorawan_classb_report(void) {
+    uint32_t beacons = classb.beacons_rx + classb.beacons_missed;
+    printf("{\"beacons_rx\":%lu,\"beacons_missed\":%lu,\"beacons_lost\":%lu,\"miss_rate_pct\":%lu,"
+        "\"acq_latency_ms\":%lu,\"drift_ppb\":%ld,\"jitter_us\":%lu,\"max_rx_error_ms\":%lu,"
+        "\"ping_slots\":%lu,\"ping_hits\":%lu,\"hit_rate_pct\":%lu,\"unmodelled_slots\":%lu,"
+        "\"radio_on_us_per_slot\":%lu,\"radio_on_ms\":%lu}\n",
+        classb.beacons_rx, classb.beacons_missed, classb.beacons_lost,
+        (beacons > 0) ? classb.beacons_missed * 100 / beacons : 0,
+        classb.acq_latency, (long) classb.drift_ppb, classb.jitter_us, classb.rx_error_ms,
+        classb.ping_slots, classb.ping_hits,
+        (classb.ping_slots > 0) ? classb.ping_hits * 100 / classb.ping_slots : 0,
+        classb.unmodelled_slots,
+        (classb.modelled_slots > 0) ? (uint32_t) (classb.radio_on_us / classb.modelled_slots) : 0,
+        (uint32_t) (classb.radio_on_us / 1000));
+}
@@ -0,0 +1,51 @@
+//  Class B Beacon Tracking for LoRaWAN Test App.
+//  Tracks the drift of the local clock against the received Beacons, adapts
+//  the maximum RX timing error (which sizes the Ping Slot windows) to the
+//  observed drift, jitter and missed Beacons, and counts the Beacon
+//  acquisition latency, Beacon miss rate, Ping Slot hit rate and the
+//  estimated radio-on time per Ping Slot.
+#ifndef __LORAWAN_CLASSB_H__
+#define __LORAWAN_CLASSB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <nuttx/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Beacon Period in seconds
+#define LORAWAN_CLASSB_BEACON_PERIOD  128
+
+/// Clear the Class B statistics. "rx_error_ms" is the initial maximum RX timing error.
+void lorawan_classb_init(uint32_t rx_error_ms);
+
+/// Set the Ping Slot Periodicity (0 to 7): one Ping Slot every 2^periodicity seconds
+void lorawan_classb_set_periodicity(uint8_t periodicity);
+
+/// Start Beacon acquisition at the time "now" (microseconds)
+void lorawan_classb_request(uint64_t now);
+
+/// Handle a received Beacon with GPS time "beacon_time" (seconds) at the local time
+/// "now" (microseconds) and datarate "dr". Returns the new maximum RX timing error (milliseconds).
+uint32_t lorawan_classb_beacon_rx(uint32_t beacon_time, uint64_t now, uint8_t dr);
+
+/// Handle a missed Beacon. Returns the new maximum RX timing error (milliseconds).
+uint32_t lorawan_classb_beacon_missed(void);
+
+/// Handle a lost Beacon at the local time "now" (microseconds): Class B has stopped and Beacon
+/// acquisition restarts. Returns the initial maximum RX timing error (milliseconds).
+uint32_t lorawan_classb_beacon_lost(uint64_t now);
+
+/// Count a downlink received in a Ping Slot
+void lorawan_classb_ping_rx(void);
+
+/// Print the Class B statistics as one line of JSON
+void lorawan_classb_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  //  __LORAWAN_CLASSB_H__
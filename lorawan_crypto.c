@@ -0,0 +1,540 @@
+//  Crypto Backends for LoRaWAN Test App.
+//  The Key Schedule and the CMAC Subkeys are computed once per Session Key
+//  and cached in Key Slots, so that Class C Multicast and FUOTA downlinks
+//  processed back to back only pay for the AES Block Encryptions.
+//  The LoRaMac Secure Element (soft-se) in liblorawan doesn't call these
+//  Backends yet: that needs a hook in liblorawan, which lives outside this
+//  app. Until then the Backends are only used by the self-test and benchmark.
+#include <nuttx/config.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include "../libs/liblorawan/src/peripherals/soft-se/aes.h"
+#include "lorawan_crypto.h"
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_AESNI
+#include <wmmintrin.h>
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_AESNI
+
+/// Number of AES-128 Rounds
+#define AES128_ROUNDS  10
+
+/// Backend Context: the expanded Key Schedule for each Backend
+union backend_ctx_u {
+    aes_context soft;                           //  Soft Backend (liblorawan soft-se)
+    uint32_t rk[4 * (AES128_ROUNDS + 1)];       //  Table Backend
+    uint8_t  ni[16 * (AES128_ROUNDS + 1)];      //  AES-NI Backend
+};
+
+/// Key Slot with the precomputed Key Schedule and CMAC Subkeys
+struct key_slot_s {
+    bool    valid;    //  True if the Key Slot is in use
+    uint8_t key_id;   //  Key ID, e.g. NWK_S_ENC_KEY, APP_S_KEY, MC_APP_S_KEY_0
+    union backend_ctx_u ctx;              //  Key Schedule
+    uint8_t k1[LORAWAN_CRYPTO_BLOCK_SIZE];  //  CMAC Subkey K1
+    uint8_t k2[LORAWAN_CRYPTO_BLOCK_SIZE];  //  CMAC Subkey K2
+};
+
+/// Key Slots for the Session Keys
+static struct key_slot_s key_slots[CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_SLOTS];
+
+/// Next Key Slot to be replaced when all Key Slots are in use
+static int next_slot = 0;
+
+/// Selected Backend
+static const struct lorawan_crypto_ops_s *backend = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+//  Soft Backend: AES from liblorawan soft-se, the same AES used by the Secure Element
+
+static bool soft_available(void) { return true; }
+
+static void soft_setkey(void *ctx, const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    aes_set_key(key, LORAWAN_CRYPTO_BLOCK_SIZE, (aes_context *) ctx);
+}
+
+static void soft_encrypt(const void *ctx, const uint8_t in[LORAWAN_CRYPTO_BLOCK_SIZE],
+    uint8_t out[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    aes_encrypt(in, out, (const aes_context *) ctx);
+}
+
+static const struct lorawan_crypto_ops_s soft_ops = {
+    .name      = "soft",
+    .available = soft_available,
+    .setkey    = soft_setkey,
+    .encrypt   = soft_encrypt,
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//  Table Backend: AES with 32-bit Lookup Tables, 4 lookups per column per round.
+//  The S-Box and a single 1 KB T-Table are generated in RAM at startup;
+//  the other 3 T-Tables are rotations of the first.
+
+/// AES S-Box
+static uint8_t sbox[256];
+
+/// T-Table: MixColumns(SubBytes(x)) as a big-endian column
+static uint32_t te0[256];
+
+/// Rotate a 32-bit word right
+#define ROR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+/// Rotate a byte left
+#define ROL8(x, n)  ((uint8_t) (((x) << (n)) | ((x) >> (8 - (n)))))
+
+/// Multiply by x in GF(2^8)
+#define XTIME(x)  ((uint8_t) (((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0)))
+
+/// Generate the S-Box and T-Table
+static bool table_available(void) {
+    if (sbox[0] == 0x63) { return true; }  //  Already generated
+
+    //  p runs through all nonzero elements as powers of 3, q through the inverses
+    uint8_t p = 1, q = 1;
+    do {
+        p = p ^ XTIME(p);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80) { q ^= 0x09; }
+        sbox[p] = 0x63 ^ q ^ ROL8(q, 1) ^ ROL8(q, 2) ^ ROL8(q, 3) ^ ROL8(q, 4);
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    for (int i = 0; i < 256; i++) {
+        uint8_t s = sbox[i];
+        uint8_t s2 = XTIME(s);
+        te0[i] = ((uint32_t) s2 << 24) | ((uint32_t) s << 16) | ((uint32_t) s << 8) | (uint8_t) (s2 ^ s);
+    }
+    return true;
+}
+
+/// Load a big-endian word
+#define LOAD32(p)  (((uint32_t) (p)[0] << 24) | ((uint32_t) (p)[1] << 16) | ((uint32_t) (p)[2] << 8) | (p)[3])
+
+/// Store a big-endian word
+#define STORE32(p, v)  do { (p)[0] = (v) >> 24; (p)[1] = (v) >> 16; (p)[2] = (v) >> 8; (p)[3] = (v); } while (0)
+
+/// Substitute each byte of a word with the S-Box
+#define SUBWORD(x)  (((uint32_t) sbox[(x) >> 24] << 24) | ((uint32_t) sbox[((x) >> 16) & 0xff] << 16) | \
+                     ((uint32_t) sbox[((x) >> 8) & 0xff] << 8) | sbox[(x) & 0xff])
+
+static void table_setkey(void *ctx, const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    uint32_t *rk = (uint32_t *) ctx;
+    uint32_t rcon = 0x01;
+    for (int i = 0; i < 4; i++) { rk[i] = LOAD32(key + 4 * i); }
+    for (int i = 4; i < 4 * (AES128_ROUNDS + 1); i++) {
+        uint32_t t = rk[i - 1];
+        if (i % 4 == 0) {
+            t = SUBWORD((t << 8) | (t >> 24)) ^ (rcon << 24);
+            rcon = XTIME(rcon);
+        }
+        rk[i] = rk[i - 4] ^ t;
+    }
+}
+
+/// One column of a full round
+#define TROUND(a, b, c, d, k)  (te0[(a) >> 24] ^ ROR32(te0[((b) >> 16) & 0xff], 8) ^ \
+                                ROR32(te0[((c) >> 8) & 0xff], 16) ^ ROR32(te0[(d) & 0xff], 24) ^ (k))
+
+/// One column of the final round, without MixColumns
+#define FROUND(a, b, c, d, k)  ((((uint32_t) sbox[(a) >> 24] << 24) | ((uint32_t) sbox[((b) >> 16) & 0xff] << 16) | \
+                                 ((uint32_t) sbox[((c) >> 8) & 0xff] << 8) | sbox[(d) & 0xff]) ^ (k))
+
+static void table_encrypt(const void *ctx, const uint8_t in[LORAWAN_CRYPTO_BLOCK_SIZE],
+    uint8_t out[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    const uint32_t *rk = (const uint32_t *) ctx;
+    uint32_t s0 = LOAD32(in)      ^ rk[0];
+    uint32_t s1 = LOAD32(in + 4)  ^ rk[1];
+    uint32_t s2 = LOAD32(in + 8)  ^ rk[2];
+    uint32_t s3 = LOAD32(in + 12) ^ rk[3];
+    for (int r = 1; r < AES128_ROUNDS; r++) {
+        rk += 4;
+        uint32_t t0 = TROUND(s0, s1, s2, s3, rk[0]);
+        uint32_t t1 = TROUND(s1, s2, s3, s0, rk[1]);
+        uint32_t t2 = TROUND(s2, s3, s0, s1, rk[2]);
+        uint32_t t3 = TROUND(s3, s0, s1, s2, rk[3]);
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+    rk += 4;
+    STORE32(out,      FROUND(s0, s1, s2, s3, rk[0]));
+    STORE32(out + 4,  FROUND(s1, s2, s3, s0, rk[1]));
+    STORE32(out + 8,  FROUND(s2, s3, s0, s1, rk[2]));
+    STORE32(out + 12, FROUND(s3, s0, s1, s2, rk[3]));
+}
+
+static const struct lorawan_crypto_ops_s table_ops = {
+    .name      = "table",
+    .available = table_available,
+    .setkey    = table_setkey,
+    .encrypt   = table_encrypt,
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//  AES-NI Backend: x86 AES Instructions, for sim:nsh on x86_64 Linux
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_AESNI
+static bool aesni_available(void) {
+    return __builtin_cpu_supports("aes");
+}
+
+/// Compute the next Round Key from the previous Round Key and the Key Generation Assist
+static __m128i aesni_expand(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+/// Round Constant must be an immediate value for _mm_aeskeygenassist_si128
+#define AESNI_ROUND_KEY(i, rcon)  rk[i] = aesni_expand(rk[(i) - 1], _mm_aeskeygenassist_si128(rk[(i) - 1], rcon))
+
+static void aesni_setkey(void *ctx, const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    __m128i rk[AES128_ROUNDS + 1];
+    rk[0] = _mm_loadu_si128((const __m128i *) key);
+    AESNI_ROUND_KEY(1, 0x01);
+    AESNI_ROUND_KEY(2, 0x02);
+    AESNI_ROUND_KEY(3, 0x04);
+    AESNI_ROUND_KEY(4, 0x08);
+    AESNI_ROUND_KEY(5, 0x10);
+    AESNI_ROUND_KEY(6, 0x20);
+    AESNI_ROUND_KEY(7, 0x40);
+    AESNI_ROUND_KEY(8, 0x80);
+    AESNI_ROUND_KEY(9, 0x1b);
+    AESNI_ROUND_KEY(10, 0x36);
+    for (int i = 0; i <= AES128_ROUNDS; i++) {
+        _mm_storeu_si128((__m128i *) ((uint8_t *) ctx + 16 * i), rk[i]);
+    }
+}
+
+static void aesni_encrypt(const void *ctx, const uint8_t in[LORAWAN_CRYPTO_BLOCK_SIZE],
+    uint8_t out[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    const __m128i *rk = (const __m128i *) ctx;
+    __m128i m = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in), _mm_loadu_si128(rk));
+    for (int i = 1; i < AES128_ROUNDS; i++) {
+        m = _mm_aesenc_si128(m, _mm_loadu_si128(rk + i));
+    }
+    m = _mm_aesenclast_si128(m, _mm_loadu_si128(rk + AES128_ROUNDS));
+    _mm_storeu_si128((__m128i *) out, m);
+}
+
+static const struct lorawan_crypto_ops_s aesni_ops = {
+    .name      = "aesni",
+    .available = aesni_available,
+    .setkey    = aesni_setkey,
+    .encrypt   = aesni_encrypt,
+};
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_AESNI
+
+///////////////////////////////////////////////////////////////////////////////
+//  Backend Selection
+
+/// Backends, fastest first
+static const struct lorawan_crypto_ops_s *const backends[] = {
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_AESNI
+    &aesni_ops,
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_AESNI
+    &table_ops,
+    &soft_ops,
+};
+
+#define NUM_BACKENDS  (sizeof(backends) / sizeof(backends[0]))
+
+/// Result of the self-test for each Backend
+static bool backend_ok[NUM_BACKENDS];
+
+/// Key ID for the self-test, cleared from the Key Slots after the self-test
+#define SELF_TEST_KEY_ID  0xff
+
+/// CMAC Test Vectors from RFC 4493 Section 4: the Messages are prefixes of the same 64 bytes
+static const uint8_t cmac_key[LORAWAN_CRYPTO_BLOCK_SIZE] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const uint8_t cmac_msg[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+static const struct {
+    uint8_t len;
+    uint8_t mac[LORAWAN_CRYPTO_BLOCK_SIZE];
+} cmac_vectors[] = {
+    {  0, { 0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46 } },
+    { 16, { 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c } },
+    { 40, { 0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27 } },
+    { 64, { 0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe } },
+};
+
+/// LoRaWAN 1.0.x Uplink 40F17DBE4900020001954378762B11FF0D with NwkSKey
+/// 44024241ED4CE9A68C6A8BC055233FD3: DevAddr 49BE7DF1, FCnt 2, MIC 2B11FF0D
+static const uint8_t mic_key[LORAWAN_CRYPTO_BLOCK_SIZE] = {
+    0x44, 0x02, 0x42, 0x41, 0xed, 0x4c, 0xe9, 0xa6, 0x8c, 0x6a, 0x8b, 0xc0, 0x55, 0x23, 0x3f, 0xd3 };
+static const uint8_t mic_msg[13] = {
+    0x40, 0xf1, 0x7d, 0xbe, 0x49, 0x00, 0x02, 0x00, 0x01, 0x95, 0x43, 0x78, 0x76 };
+#define MIC_DEV_ADDR  0x49be7df1
+#define MIC_FCNT      2
+#define MIC_EXPECTED  0x0dff112b  //  MIC bytes 2B 11 FF 0D, little endian
+
+/// Check the Backend with the AES-128 test vector from FIPS-197 Appendix C.1,
+/// the AES-CMAC test vectors from RFC 4493 and a LoRaWAN Frame MIC (Block B0)
+static bool self_test(const struct lorawan_crypto_ops_s *ops) {
+    static const uint8_t key[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    static const uint8_t plain[16] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    static const uint8_t cipher[16] = {
+        0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+    union backend_ctx_u ctx;
+    uint8_t out[16];
+    ops->setkey(&ctx, key);
+    ops->encrypt(&ctx, plain, out);
+    if (memcmp(out, cipher, sizeof(out)) != 0) { return false; }
+
+    //  Run the CMAC through the Key Slots with this Backend
+    const struct lorawan_crypto_ops_s *selected = backend;
+    bool ok = true;
+    backend = ops;
+    lorawan_crypto_setkey(SELF_TEST_KEY_ID, cmac_key);
+    for (int i = 0; ok && i < sizeof(cmac_vectors) / sizeof(cmac_vectors[0]); i++) {
+        ok = lorawan_crypto_cmac(SELF_TEST_KEY_ID, NULL, cmac_msg, cmac_vectors[i].len, out) == 0 &&
+            memcmp(out, cmac_vectors[i].mac, sizeof(out)) == 0;
+    }
+    uint32_t mic = 0;
+    lorawan_crypto_setkey(SELF_TEST_KEY_ID, mic_key);
+    ok = ok && lorawan_crypto_frame_mic(SELF_TEST_KEY_ID, LORAWAN_CRYPTO_UPLINK, MIC_DEV_ADDR, MIC_FCNT,
+        mic_msg, sizeof(mic_msg), &mic) == 0 && mic == MIC_EXPECTED;
+
+    //  Clear the Key Slots and restore the selected Backend
+    memset(key_slots, 0, sizeof(key_slots));
+    next_slot = 0;
+    backend = selected;
+    return ok;
+}
+
+/// Init the Backends and select the fastest Backend that passes the self-test.
+/// Returns 0 if successful.
+int lorawan_crypto_init(void) {
+    backend = NULL;
+    for (int i = 0; i < NUM_BACKENDS; i++) {
+        const struct lorawan_crypto_ops_s *ops = backends[i];
+        bool available = ops->available();
+        backend_ok[i] = available && self_test(ops);
+        printf("lorawan_crypto_init: %s %s\n", ops->name,
+            backend_ok[i] ? "OK" : (available ? "failed self-test" : "unavailable"));
+        if (backend_ok[i] && backend == NULL) { lorawan_crypto_select(ops->name); }
+    }
+    return (backend != NULL) ? 0 : -ENODEV;
+}
+
+/// Select the Backend by name. Clears the Key Slots. Returns 0 if successful.
+int lorawan_crypto_select(const char *name) {
+    assert(name != NULL);
+    for (int i = 0; i < NUM_BACKENDS; i++) {
+        if (backend_ok[i] && strcmp(backends[i]->name, name) == 0) {
+            backend = backends[i];
+            memset(key_slots, 0, sizeof(key_slots));
+            next_slot = 0;
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+/// Return the selected Backend
+const struct lorawan_crypto_ops_s *lorawan_crypto_backend(void) {
+    return backend;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//  Key Slots
+
+/// Return the Key Slot for the Key ID, or NULL if the Key is not stored
+static struct key_slot_s *find_slot(uint8_t key_id) {
+    for (int i = 0; i < CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_SLOTS; i++) {
+        if (key_slots[i].valid && key_slots[i].key_id == key_id) { return &key_slots[i]; }
+    }
+    return NULL;
+}
+
+/// Derive a CMAC Subkey by shifting left one bit (RFC 4493 Section 2.3)
+static void derive_subkey(const uint8_t in[LORAWAN_CRYPTO_BLOCK_SIZE], uint8_t out[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    for (int i = 0; i < LORAWAN_CRYPTO_BLOCK_SIZE - 1; i++) {
+        out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+    }
+    out[LORAWAN_CRYPTO_BLOCK_SIZE - 1] = (in[LORAWAN_CRYPTO_BLOCK_SIZE - 1] << 1) ^ ((in[0] & 0x80) ? 0x87 : 0);
+}
+
+/// Store the Key (e.g. NwkSKey, AppSKey or Multicast Session Key) for the
+/// Key ID and precompute its Key Schedule. Returns 0 if successful.
+int lorawan_crypto_setkey(uint8_t key_id, const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    assert(key != NULL);
+    if (backend == NULL) { return -ENODEV; }
+
+    //  Reuse the Key Slot for the Key ID, else take a free Key Slot, else replace the oldest
+    struct key_slot_s *slot = find_slot(key_id);
+    for (int i = 0; slot == NULL && i < CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_SLOTS; i++) {
+        if (!key_slots[i].valid) { slot = &key_slots[i]; }
+    }
+    if (slot == NULL) {
+        slot = &key_slots[next_slot];
+        next_slot = (next_slot + 1) % CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO_SLOTS;
+    }
+
+    //  Expand the Key Schedule and derive the CMAC Subkeys from L = AES(Key, 0)
+    static const uint8_t zero[LORAWAN_CRYPTO_BLOCK_SIZE] = { 0 };
+    uint8_t l[LORAWAN_CRYPTO_BLOCK_SIZE];
+    backend->setkey(&slot->ctx, key);
+    backend->encrypt(&slot->ctx, zero, l);
+    derive_subkey(l, slot->k1);
+    derive_subkey(slot->k1, slot->k2);
+    slot->key_id = key_id;
+    slot->valid  = true;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//  MIC and Payload Encryption
+
+/// Compute the AES-CMAC of the Block B0 (may be NULL) followed by the Message.
+/// Returns 0 if successful.
+int lorawan_crypto_cmac(uint8_t key_id, const uint8_t *b0, const uint8_t *msg, size_t len,
+    uint8_t cmac[LORAWAN_CRYPTO_BLOCK_SIZE]) {
+    assert(cmac != NULL && (msg != NULL || len == 0));
+    struct key_slot_s *slot = find_slot(key_id);
+    if (slot == NULL) { return -ENOENT; }
+
+    //  B0 and the Message are processed as one stream
+    size_t off = (b0 != NULL) ? LORAWAN_CRYPTO_BLOCK_SIZE : 0;
+    size_t total = off + len;
+    size_t blocks = (total + LORAWAN_CRYPTO_BLOCK_SIZE - 1) / LORAWAN_CRYPTO_BLOCK_SIZE;
+    bool complete = (total > 0) && (total % LORAWAN_CRYPTO_BLOCK_SIZE == 0);
+    if (blocks == 0) { blocks = 1; }
+
+    uint8_t x[LORAWAN_CRYPTO_BLOCK_SIZE] = { 0 };
+    size_t pos = 0;
+    for (size_t b = 0; b < blocks; b++) {
+        bool last = (b == blocks - 1);
+        for (int i = 0; i < LORAWAN_CRYPTO_BLOCK_SIZE; i++, pos++) {
+            uint8_t m;
+            if (pos < off)        { m = b0[pos]; }
+            else if (pos < total) { m = msg[pos - off]; }
+            else                  { m = (pos == total) ? 0x80 : 0; }  //  Padding
+
+            //  The last block is masked with K1 if complete, else K2
+            if (last) { m ^= complete ? slot->k1[i] : slot->k2[i]; }
+            x[i] ^= m;
+        }
+        backend->encrypt(&slot->ctx, x, x);
+    }
+    memcpy(cmac, x, LORAWAN_CRYPTO_BLOCK_SIZE);
+    return 0;
+}
+
+/// Compose the Block B0 (for MIC) or Ai (for Payload Encryption) of a LoRaWAN Data Frame
+static void compose_block(uint8_t block[LORAWAN_CRYPTO_BLOCK_SIZE], uint8_t type, uint8_t dir,
+    uint32_t dev_addr, uint32_t fcnt, uint8_t last) {
+    memset(block, 0, LORAWAN_CRYPTO_BLOCK_SIZE);
+    block[0]  = type;
+    block[5]  = dir;
+    block[6]  = dev_addr & 0xff;
+    block[7]  = (dev_addr >> 8) & 0xff;
+    block[8]  = (dev_addr >> 16) & 0xff;
+    block[9]  = (dev_addr >> 24) & 0xff;
+    block[10] = fcnt & 0xff;
+    block[11] = (fcnt >> 8) & 0xff;
+    block[12] = (fcnt >> 16) & 0xff;
+    block[13] = (fcnt >> 24) & 0xff;
+    block[15] = last;
+}
+
+/// Compute the MIC of a LoRaWAN 1.0.x Data Frame. Returns 0 if successful.
+int lorawan_crypto_frame_mic(uint8_t key_id, uint8_t dir, uint32_t dev_addr, uint32_t fcnt,
+    const uint8_t *msg, uint8_t len, uint32_t *mic) {
+    assert(mic != NULL);
+    uint8_t b0[LORAWAN_CRYPTO_BLOCK_SIZE];
+    uint8_t cmac[LORAWAN_CRYPTO_BLOCK_SIZE];
+    compose_block(b0, 0x49, dir, dev_addr, fcnt, len);
+    int rc = lorawan_crypto_cmac(key_id, b0, msg, len, cmac);
+    if (rc < 0) { return rc; }
+    *mic = ((uint32_t) cmac[3] << 24) | ((uint32_t) cmac[2] << 16) | ((uint32_t) cmac[1] << 8) | cmac[0];
+    return 0;
+}
+
+/// Encrypt or decrypt the FRMPayload of a LoRaWAN Data Frame in place with AES-CTR.
+/// Returns 0 if successful.
+int lorawan_crypto_payload(uint8_t key_id, uint8_t dir, uint32_t dev_addr, uint32_t fcnt,
+    uint8_t *buf, size_t len) {
+    assert(buf != NULL || len == 0);
+    struct key_slot_s *slot = find_slot(key_id);
+    if (slot == NULL) { return -ENOENT; }
+
+    uint8_t a[LORAWAN_CRYPTO_BLOCK_SIZE];
+    uint8_t s[LORAWAN_CRYPTO_BLOCK_SIZE];
+    uint8_t ctr = 1;
+    for (size_t pos = 0; pos < len; pos += LORAWAN_CRYPTO_BLOCK_SIZE) {
+        compose_block(a, 0x01, dir, dev_addr, fcnt, ctr++);
+        backend->encrypt(&slot->ctx, a, s);
+        size_t n = (len - pos < LORAWAN_CRYPTO_BLOCK_SIZE) ? len - pos : LORAWAN_CRYPTO_BLOCK_SIZE;
+        for (size_t i = 0; i < n; i++) { buf[pos + i] ^= s[i]; }
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//  Benchmark
+
+/// Return the current monotonic time in microseconds
+static uint32_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// Process one frame: decrypt a 51-byte FRMPayload and compute the MIC over the
+/// 64-byte frame. If rekey is true, recompute the Key Schedule and CMAC Subkeys
+/// per operation with this module. This is not the soft-se code path.
+static void bench_frame(bool rekey, const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE],
+    uint8_t frame[64], uint32_t fcnt) {
+    uint32_t mic;
+    if (rekey) { lorawan_crypto_setkey(0, key); }
+    lorawan_crypto_payload(0, LORAWAN_CRYPTO_DOWNLINK, 0x01020304, fcnt, frame + 13, 51);
+    if (rekey) { lorawan_crypto_setkey(1, key); }
+    lorawan_crypto_frame_mic(1, LORAWAN_CRYPTO_DOWNLINK, 0x01020304, fcnt, frame, 64, &mic);
+    frame[0] ^= mic;  //  Keep the MIC alive
+}
+
+/// Print the MIC and Payload Encryption cost per frame for each Backend,
+/// with the Key Schedule expanded per operation and cached
+void lorawan_crypto_bench(int iterations) {
+    assert(iterations > 0);
+    static const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE] = {
+        0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+    uint8_t frame[64] = { 0 };
+
+    const struct lorawan_crypto_ops_s *selected = backend;
+    for (int i = 0; i < NUM_BACKENDS; i++) {
+        if (!backend_ok[i]) { continue; }
+        lorawan_crypto_select(backends[i]->name);
+
+        //  Session Keys expanded for every operation
+        uint32_t start = now_us();
+        for (int n = 0; n < iterations; n++) { bench_frame(true, key, frame, n); }
+        uint32_t rekey = now_us() - start;
+
+        //  Session Keys expanded once and cached
+        lorawan_crypto_setkey(0, key);
+        lorawan_crypto_setkey(1, key);
+        start = now_us();
+        for (int n = 0; n < iterations; n++) { bench_frame(false, key, frame, n); }
+        uint32_t cached = now_us() - start;
+
+        printf("{\"backend\":\"%s\",\"frames\":%d,\"rekey_ns_per_frame\":%lu,\"cached_ns_per_frame\":%lu}\n",
+            backends[i]->name, iterations,
+            (uint32_t) ((uint64_t) rekey * 1000 / iterations),
+            (uint32_t) ((uint64_t) cached * 1000 / iterations));
+    }
+
+    //  Restore the selected Backend
+    if (selected != NULL) { lorawan_crypto_select(selected->name); }
+}
@@ -0,0 +1,70 @@
+//  Crypto Backends for LoRaWAN Test App.
+//  AES-CMAC (MIC) and AES-CTR (Payload Encryption) over a pluggable AES-128
+//  Backend, with the Key Schedule and CMAC Subkeys precomputed once per
+//  Session Key and cached in Key Slots. Not yet called by the liblorawan
+//  Secure Element.
+#ifndef __LORAWAN_CRYPTO_H__
+#define __LORAWAN_CRYPTO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <nuttx/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Size of AES Block and AES-128 Key in bytes
+#define LORAWAN_CRYPTO_BLOCK_SIZE  16
+
+/// Direction of the LoRaWAN Frame, for computing the MIC and encrypting the Payload
+#define LORAWAN_CRYPTO_UPLINK    0
+#define LORAWAN_CRYPTO_DOWNLINK  1
+
+/// AES-128 Backend. The Backend Context holds the expanded Key Schedule.
+struct lorawan_crypto_ops_s {
+    const char *name;  //  Name of the Backend
+    bool (*available)(void);  //  Return true if the Backend is supported by the CPU
+    void (*setkey)(void *ctx, const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE]);  //  Expand the Key Schedule
+    void (*encrypt)(const void *ctx, const uint8_t in[LORAWAN_CRYPTO_BLOCK_SIZE],
+        uint8_t out[LORAWAN_CRYPTO_BLOCK_SIZE]);  //  Encrypt one AES Block
+};
+
+/// Init the Backends and select the fastest Backend that passes the self-test
+/// (FIPS-197 AES, RFC 4493 AES-CMAC and a LoRaWAN Frame MIC). Returns 0 if successful.
+int lorawan_crypto_init(void);
+
+/// Select the Backend by name. Clears the Key Slots. Returns 0 if successful.
+int lorawan_crypto_select(const char *name);
+
+/// Return the selected Backend
+const struct lorawan_crypto_ops_s *lorawan_crypto_backend(void);
+
+/// Store the Key (e.g. NwkSKey, AppSKey or Multicast Session Key) for the
+/// Key ID and precompute its Key Schedule. Returns 0 if successful.
+int lorawan_crypto_setkey(uint8_t key_id, const uint8_t key[LORAWAN_CRYPTO_BLOCK_SIZE]);
+
+/// Compute the AES-CMAC of the Block B0 (may be NULL) followed by the Message.
+/// Returns 0 if successful.
+int lorawan_crypto_cmac(uint8_t key_id, const uint8_t *b0, const uint8_t *msg, size_t len,
+    uint8_t cmac[LORAWAN_CRYPTO_BLOCK_SIZE]);
+
+/// Compute the MIC of a LoRaWAN 1.0.x Data Frame. Returns 0 if successful.
+int lorawan_crypto_frame_mic(uint8_t key_id, uint8_t dir, uint32_t dev_addr, uint32_t fcnt,
+    const uint8_t *msg, uint8_t len, uint32_t *mic);
+
+/// Encrypt or decrypt the FRMPayload of a LoRaWAN Data Frame in place with AES-CTR.
+/// Returns 0 if successful.
+int lorawan_crypto_payload(uint8_t key_id, uint8_t dir, uint32_t dev_addr, uint32_t fcnt,
+    uint8_t *buf, size_t len);
+
+/// Print the MIC and Payload Encryption cost per frame for each Backend,
+/// with the Key Schedule expanded per operation and cached
+void lorawan_crypto_bench(int iterations);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  //  __LORAWAN_CRYPTO_H__
@@ -0,0 +1,158 @@
+//  RAM and Stack Instrumentation for LoRaWAN Test App.
+//  With CONFIG_STACK_COLORATION the Stack High-Water Mark is measured from
+//  the painted stack. The paint is never restored, so only the High-Water Mark
+//  of the whole run is known, not the peak of each Phase. Otherwise the current
+//  Stack Depth is sampled at each Sample Point and kept as the peak of the
+//  current Phase, which underestimates the true High-Water Mark.
+#include <nuttx/config.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <malloc.h>
+#ifdef CONFIG_STACK_COLORATION
+#include <nuttx/arch.h>
+#endif  //  CONFIG_STACK_COLORATION
+#include "lorawan_mem.h"
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+
+/// Maximum number of Subsystems for Static RAM
+#define MAX_SUBSYSTEMS  8
+
+/// Static RAM used by a Subsystem
+struct subsystem_s {
+    const char *name;  //  Name of Subsystem
+    size_t size;       //  Static RAM in bytes
+};
+
+/// Peak usage during a Phase
+struct phase_peak_s {
+    size_t stack;  //  Deepest Stack Depth sampled (bytes), not tracked with Stack Coloration
+    size_t heap;   //  Heap in use (bytes)
+};
+
+/// Names of the Phases
+static const char *const phase_names[LORAWAN_MEM_NUM_PHASES] = {
+    "idle", "join", "uplink", "frag"
+};
+
+/// Registered Subsystems
+static struct subsystem_s subsystems[MAX_SUBSYSTEMS];
+static int num_subsystems = 0;
+
+/// Peak usage for each Phase
+static struct phase_peak_s peaks[LORAWAN_MEM_NUM_PHASES];
+
+/// Current Phase
+static enum lorawan_mem_phase_e current_phase = LORAWAN_MEM_IDLE;
+
+/// Base of the stack, for sampling the Stack Depth
+static uintptr_t stack_base = 0;
+
+/// Deepest Stack Depth sampled
+static size_t stack_sampled = 0;
+
+#ifndef CONFIG_STACK_COLORATION
+/// Return the current Stack Depth in bytes
+static size_t stack_depth(void) {
+    //  Stack grows downwards
+    return stack_base - (uintptr_t) __builtin_frame_address(0);
+}
+#endif  //  !CONFIG_STACK_COLORATION
+
+/// Return the Stack High-Water Mark of the whole run in bytes
+static size_t stack_used(void) {
+#ifdef CONFIG_STACK_COLORATION
+    return up_check_stack();
+#else
+    return stack_sampled;
+#endif  //  CONFIG_STACK_COLORATION
+}
+
+/// Return the Heap in use in bytes
+static size_t heap_used(void) {
+    struct mallinfo info = mallinfo();
+    return info.uordblks;
+}
+
+/// Start the instrumentation. Must be called at the start of main,
+/// which is taken as the base of the stack when Stack Coloration is disabled.
+void lorawan_mem_init(void) {
+    stack_base     = (uintptr_t) __builtin_frame_address(0);
+    stack_sampled  = 0;
+    num_subsystems = 0;
+    current_phase  = LORAWAN_MEM_IDLE;
+    memset(peaks, 0, sizeof(peaks));
+}
+
+/// Register the Static RAM used by a Subsystem. "name" must be a string literal.
+void lorawan_mem_register(const char *name, size_t size) {
+    assert(name != NULL);
+    if (num_subsystems >= MAX_SUBSYSTEMS) { return; }
+    subsystems[num_subsystems].name = name;
+    subsystems[num_subsystems].size = size;
+    num_subsystems++;
+}
+
+/// Sample the Stack and Heap Usage, then enter the Phase
+void lorawan_mem_phase(enum lorawan_mem_phase_e phase) {
+    assert(phase < LORAWAN_MEM_NUM_PHASES);
+    lorawan_mem_sample();
+    current_phase = phase;
+}
+
+/// Sample the Stack and Heap Usage for the current Phase
+void lorawan_mem_sample(void) {
+    struct phase_peak_s *peak = &peaks[current_phase];
+#ifndef CONFIG_STACK_COLORATION
+    size_t stack = stack_depth();
+    if (stack > peak->stack)   { peak->stack   = stack; }
+    if (stack > stack_sampled) { stack_sampled = stack; }
+#endif  //  !CONFIG_STACK_COLORATION
+    size_t heap = heap_used();
+    if (heap > peak->heap) { peak->heap = heap; }
+}
+
+/// Print the Stack, Static RAM and Heap Usage
+void lorawan_mem_report(void) {
+    lorawan_mem_sample();
+
+    //  Stack
+    printf("lorawan_mem: stack size=%d, used=%zu (%s)\n",
+        CONFIG_EXAMPLES_LORAWAN_TEST_STACKSIZE, stack_used(),
+#ifdef CONFIG_STACK_COLORATION
+        "high-water mark"
+#else
+        "sampled"
+#endif  //  CONFIG_STACK_COLORATION
+    );
+
+    //  Static RAM
+    size_t total = 0;
+    for (int i = 0; i < num_subsystems; i++) {
+        printf("lorawan_mem: static %s=%zu\n", subsystems[i].name, subsystems[i].size);
+        total += subsystems[i].size;
+    }
+    printf("lorawan_mem: static total=%zu\n", total);
+    puts("lorawan_mem: static RAM inside liblorawan (LoRaMac, FragDecoder, RemoteMcastSetup, Region) not included");
+
+    //  Heap
+    struct mallinfo info = mallinfo();
+    printf("lorawan_mem: heap arena=%d, used=%d, free=%d, largest=%d\n",
+        info.arena, info.uordblks, info.fordblks, info.mxordblk);
+
+    //  Peak usage for each Phase
+    for (int i = 0; i < LORAWAN_MEM_NUM_PHASES; i++) {
+#ifdef CONFIG_STACK_COLORATION
+        //  Only the High-Water Mark of the whole run is known
+        printf("lorawan_mem: peak %s stack=n/a, heap=%zu\n",
+            phase_names[i], peaks[i].heap);
+#else
+        printf("lorawan_mem: peak %s stack=%zu, heap=%zu\n",
+            phase_names[i], peaks[i].stack, peaks[i].heap);
+#endif  //  CONFIG_STACK_COLORATION
+    }
+}
+
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
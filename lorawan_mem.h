@@ -0,0 +1,54 @@
+//  RAM and Stack Instrumentation for LoRaWAN Test App.
+//  Reports the Stack High-Water Mark of the lorawan_test task, the Static
+//  RAM of each Subsystem of the app and the Heap Usage, with the peak usage
+//  during each Phase (Join, Uplink, Fragmentation Session).
+#ifndef __LORAWAN_MEM_H__
+#define __LORAWAN_MEM_H__
+
+#include <stddef.h>
+#include <nuttx/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Phases tracked for peak usage
+enum lorawan_mem_phase_e {
+    LORAWAN_MEM_IDLE = 0,  //  Waiting for Events
+    LORAWAN_MEM_JOIN,      //  Joining the LoRaWAN Network
+    LORAWAN_MEM_UPLINK,    //  Sending an Uplink until MCPS Confirm
+    LORAWAN_MEM_FRAG,      //  Receiving a Fragmentation Session
+    LORAWAN_MEM_NUM_PHASES
+};
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+
+/// Start the instrumentation. Must be called at the start of main,
+/// which is taken as the base of the stack when Stack Coloration is disabled.
+void lorawan_mem_init(void);
+
+/// Register the Static RAM used by a Subsystem. "name" must be a string literal.
+void lorawan_mem_register(const char *name, size_t size);
+
+/// Sample the Stack and Heap Usage, then enter the Phase
+void lorawan_mem_phase(enum lorawan_mem_phase_e phase);
+
+/// Sample the Stack and Heap Usage for the current Phase
+void lorawan_mem_sample(void);
+
+/// Print the Stack, Static RAM and Heap Usage
+void lorawan_mem_report(void);
+
+#else
+
+//  Instrumentation is disabled: compile the Sample Points to nothing
+#define lorawan_mem_phase(phase)
+#define lorawan_mem_sample()
+
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  //  __LORAWAN_MEM_H__
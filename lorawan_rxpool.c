@@ -0,0 +1,204 @@
+//  Downlink Frame Pool for LoRaWAN Test App.
+//  Frames are put and dispatched on the lorawan_test task: the MAC Callbacks
+//  run in the Event Loop, so no locking is needed.
+#include <nuttx/config.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "../libs/liblorawan/src/mac/LoRaMac.h"
+#include "lorawan_rxpool.h"
+
+/// Maximum number of Consumers
+#define MAX_CONSUMERS  4
+
+/// Downlink Streams tracked for statistics. RX1, RX2, Class C and Class B
+/// Ping Slot downlinks share the Unicast FCntDown. Each Multicast Receive Slot
+/// has its own Multicast Group Counter.
+enum rx_stream_e {
+    STREAM_UNICAST = 0,        //  RX_SLOT_WIN_1, RX_SLOT_WIN_2, RX_SLOT_WIN_CLASS_C, RX_SLOT_WIN_CLASS_B_PING_SLOT
+    STREAM_CLASS_C_MULTICAST,  //  RX_SLOT_WIN_CLASS_C_MULTICAST
+    STREAM_CLASS_B_MULTICAST,  //  RX_SLOT_WIN_CLASS_B_MULTICAST_SLOT
+    NUM_STREAMS
+};
+
+/// Names of the Downlink Streams
+static const char *const stream_names[NUM_STREAMS] = {
+    "unicast", "class_c_multicast", "class_b_multicast"
+};
+
+/// Consumer of Downlink Frames for a Port
+struct consumer_s {
+    uint8_t port;  //  Port, or 0 for all Ports
+    lorawan_rxpool_consumer_t consumer;
+};
+
+/// Statistics for a Downlink Stream. LmHandler doesn't pass the Multicast Group
+/// Address to the application, so Multicast Groups sharing a Receive Slot
+/// are counted together.
+struct rx_stats_s {
+    uint32_t frames;      //  Frames received
+    uint32_t dropped;     //  Frames dropped because the Pool was exhausted
+    uint32_t lost;        //  Frames missing according to the FCnt gaps
+    uint32_t gaps;        //  Number of FCnt gaps
+    uint32_t duplicates;  //  Frames with FCnt not greater than the last FCnt
+    uint32_t last_fcnt;   //  FCnt of the last Frame
+};
+
+/// Frame Pool
+static struct lorawan_rxframe_s frames[CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES];
+
+/// Free Frames, as a stack
+static struct lorawan_rxframe_s *free_frames[CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES];
+static int num_free = 0;
+
+/// Queued Frames, as a ring
+static struct lorawan_rxframe_s *queue[CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES];
+static int queue_head = 0;
+static int queue_count = 0;
+
+/// Most Frames in use at the same time
+static int max_in_use = 0;
+
+/// Registered Consumers
+static struct consumer_s consumers[MAX_CONSUMERS];
+static int num_consumers = 0;
+
+/// Statistics for each Downlink Stream
+static struct rx_stats_s rx_stats[NUM_STREAMS];
+
+/// Init the Frame Pool and clear the statistics
+void lorawan_rxpool_init(void) {
+    for (int i = 0; i < CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES; i++) {
+        frames[i].refs = 0;
+        free_frames[i] = &frames[i];
+    }
+    num_free      = CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES;
+    queue_head    = 0;
+    queue_count   = 0;
+    max_in_use    = 0;
+    num_consumers = 0;
+    memset(rx_stats, 0, sizeof(rx_stats));
+}
+
+/// Register a Consumer for the Port, or for all Ports if Port is 0.
+/// Returns 0 if successful.
+int lorawan_rxpool_register(uint8_t port, lorawan_rxpool_consumer_t consumer) {
+    assert(consumer != NULL);
+    if (num_consumers >= MAX_CONSUMERS) { return -ENOMEM; }
+    consumers[num_consumers].port     = port;
+    consumers[num_consumers].consumer = consumer;
+    num_consumers++;
+    return 0;
+}
+
+/// Return the Downlink Stream for the Receive Slot, or -1 if unknown
+static int stream_of(int8_t rx_slot) {
+    switch (rx_slot) {
+        case RX_SLOT_WIN_1:
+        case RX_SLOT_WIN_2:
+        case RX_SLOT_WIN_CLASS_C:
+        case RX_SLOT_WIN_CLASS_B_PING_SLOT:      return STREAM_UNICAST;
+        case RX_SLOT_WIN_CLASS_C_MULTICAST:      return STREAM_CLASS_C_MULTICAST;
+        case RX_SLOT_WIN_CLASS_B_MULTICAST_SLOT: return STREAM_CLASS_B_MULTICAST;
+        default:                                 return -1;
+    }
+}
+
+/// Count the Frame and its FCnt gap for the Downlink Stream of the Receive Slot
+static void count_frame(int8_t rx_slot, uint32_t fcnt, bool dropped) {
+    int stream = stream_of(rx_slot);
+    if (stream < 0) { return; }
+    struct rx_stats_s *stats = &rx_stats[stream];
+    if (stats->frames > 0) {
+        if (fcnt <= stats->last_fcnt) {
+            stats->duplicates++;
+        } else if (fcnt != stats->last_fcnt + 1) {
+            stats->gaps++;
+            stats->lost += fcnt - stats->last_fcnt - 1;
+        }
+    }
+    stats->frames++;
+    stats->last_fcnt = fcnt;
+    if (dropped) { stats->dropped++; }
+}
+
+/// Copy a Downlink into a Frame from the Pool and queue the Frame for dispatch.
+/// Returns 0 if successful, or -ENOMEM if the Pool is exhausted and the Frame was dropped.
+int lorawan_rxpool_put(uint8_t port, int8_t rx_slot, uint32_t fcnt, int8_t rssi, int8_t snr,
+    const uint8_t *data, uint8_t size) {
+    assert(data != NULL || size == 0);
+    assert(size <= LORAWAN_RXFRAME_SIZE);
+    if (num_free == 0) {
+        count_frame(rx_slot, fcnt, true);
+        return -ENOMEM;
+    }
+    count_frame(rx_slot, fcnt, false);
+
+    //  Take a Frame from the Pool and copy the Downlink
+    struct lorawan_rxframe_s *frame = free_frames[--num_free];
+    frame->refs    = 1;
+    frame->port    = port;
+    frame->size    = size;
+    frame->rx_slot = rx_slot;
+    frame->fcnt    = fcnt;
+    frame->rssi    = rssi;
+    frame->snr     = snr;
+    memcpy(frame->data, data, size);
+
+    int in_use = CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES - num_free;
+    if (in_use > max_in_use) { max_in_use = in_use; }
+
+    //  Queue the Frame. The queue never overflows because it has one entry per Frame.
+    queue[(queue_head + queue_count) % CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES] = frame;
+    queue_count++;
+    return 0;
+}
+
+/// Dispatch the queued Frames to the Consumers. Returns the number of Frames dispatched.
+int lorawan_rxpool_dispatch(void) {
+    int count = 0;
+    while (queue_count > 0) {
+        struct lorawan_rxframe_s *frame = queue[queue_head];
+        queue_head = (queue_head + 1) % CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES;
+        queue_count--;
+
+        //  Pass the Frame by reference to the Consumers for the Port
+        for (int i = 0; i < num_consumers; i++) {
+            if (consumers[i].port == 0 || consumers[i].port == frame->port) {
+                consumers[i].consumer(frame);
+            }
+        }
+
+        //  Release the reference taken by lorawan_rxpool_put
+        lorawan_rxpool_release(frame);
+        count++;
+    }
+    return count;
+}
+
+/// Hold a reference to the Frame, so that it's not returned to the Pool after dispatch
+void lorawan_rxpool_hold(struct lorawan_rxframe_s *frame) {
+    assert(frame != NULL && frame->refs > 0);
+    frame->refs++;
+}
+
+/// Release a reference to the Frame. The Frame returns to the Pool when unreferenced.
+void lorawan_rxpool_release(struct lorawan_rxframe_s *frame) {
+    assert(frame != NULL && frame->refs > 0);
+    if (--frame->refs == 0) {
+        free_frames[num_free++] = frame;
+    }
+}
+
+/// Print the Frame counts, drops, losses and FCnt gaps for each Downlink Stream
+void lorawan_rxpool_report(void) {
+    printf("lorawan_rxpool: pool=%d, free=%d, max_in_use=%d\n",
+        CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES, num_free, max_in_use);
+    for (int i = 0; i < NUM_STREAMS; i++) {
+        const struct rx_stats_s *stats = &rx_stats[i];
+        if (stats->frames == 0) { continue; }
+        printf("{\"stream\":\"%s\",\"frames\":%lu,\"dropped\":%lu,\"lost\":%lu,\"gaps\":%lu,\"duplicates\":%lu,\"last_fcnt\":%lu}\n",
+            stream_names[i], stats->frames, stats->dropped, stats->lost, stats->gaps, stats->duplicates, stats->last_fcnt);
+    }
+}
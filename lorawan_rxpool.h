@@ -0,0 +1,66 @@
+//  Downlink Frame Pool for LoRaWAN Test App.
+//  Downlinks are copied from the MAC into Frames from a fixed preallocated
+//  Pool and queued. The Event Loop dispatches the queued Frames to the
+//  Consumers by reference after the MAC Callback has returned, so that
+//  Class C Multicast downlinks arriving back to back are not processed
+//  synchronously in the MAC Callback.
+#ifndef __LORAWAN_RXPOOL_H__
+#define __LORAWAN_RXPOOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <nuttx/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Maximum size of the Frame Payload in bytes
+#define LORAWAN_RXFRAME_SIZE  242
+
+/// Downlink Frame
+struct lorawan_rxframe_s {
+    uint32_t fcnt;     //  Downlink Frame Counter (Multicast Group Counter for Multicast Frames)
+    uint8_t  refs;     //  References held on the Frame
+    uint8_t  port;     //  Application Port
+    uint8_t  size;     //  Payload Size in bytes
+    int8_t   rx_slot;  //  Receive Slot, e.g. RX_SLOT_WIN_CLASS_C_MULTICAST
+    int8_t   rssi;     //  RSSI in dBm
+    int8_t   snr;      //  SNR in dB
+    uint8_t  data[LORAWAN_RXFRAME_SIZE];  //  Payload
+};
+
+/// Consumer of Downlink Frames. The Frame is valid only during the call,
+/// unless the Consumer calls lorawan_rxpool_hold.
+typedef void (*lorawan_rxpool_consumer_t)(struct lorawan_rxframe_s *frame);
+
+/// Init the Frame Pool and clear the statistics
+void lorawan_rxpool_init(void);
+
+/// Register a Consumer for the Port, or for all Ports if Port is 0.
+/// Returns 0 if successful.
+int lorawan_rxpool_register(uint8_t port, lorawan_rxpool_consumer_t consumer);
+
+/// Copy a Downlink into a Frame from the Pool and queue the Frame for dispatch.
+/// Returns 0 if successful, or -ENOMEM if the Pool is exhausted and the Frame was dropped.
+int lorawan_rxpool_put(uint8_t port, int8_t rx_slot, uint32_t fcnt, int8_t rssi, int8_t snr,
+    const uint8_t *data, uint8_t size);
+
+/// Dispatch the queued Frames to the Consumers. Returns the number of Frames dispatched.
+int lorawan_rxpool_dispatch(void);
+
+/// Hold a reference to the Frame, so that it's not returned to the Pool after dispatch
+void lorawan_rxpool_hold(struct lorawan_rxframe_s *frame);
+
+/// Release a reference to the Frame. The Frame returns to the Pool when unreferenced.
+void lorawan_rxpool_release(struct lorawan_rxframe_s *frame);
+
+/// Print the Frame counts, drops, losses and FCnt gaps for Unicast (RX1, RX2,
+/// Class C and Class B Ping Slots share one FCntDown) and each Multicast Receive Slot
+void lorawan_rxpool_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  //  __LORAWAN_RXPOOL_H__
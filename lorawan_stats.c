@@ -0,0 +1,74 @@
+//  Uplink Statistics for LoRaWAN Test App
+#include <nuttx/config.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "lorawan_stats.h"
+
+/// Clear the statistics
+void lorawan_stats_reset(struct lorawan_stats_s *stats) {
+    assert(stats != NULL);
+    memset(stats, 0, sizeof(*stats));
+}
+
+/// Count an attempt to send a frame at the time "now" (milliseconds)
+void lorawan_stats_attempt(struct lorawan_stats_s *stats, uint32_t now) {
+    if (stats->attempted == 0) { stats->start = now; }
+    stats->attempted++;
+}
+
+/// Count a frame of "size" bytes accepted by LmHandlerSend at the time "now" (milliseconds)
+void lorawan_stats_sent(struct lorawan_stats_s *stats, uint8_t size, uint32_t now) {
+    stats->sent++;
+    stats->bytes += size;
+    stats->send_time = now;
+}
+
+/// Count the MCPS Confirm of the last frame sent, at the time "now" (milliseconds)
+void lorawan_stats_done(struct lorawan_stats_s *stats, bool acked, uint32_t now) {
+    if (!lorawan_stats_pending(stats)) { return; }  //  Not our frame
+
+    uint32_t latency = now - stats->send_time;
+    stats->latency[stats->done % CONFIG_EXAMPLES_LORAWAN_TEST_LATENCY_SAMPLES] = latency;
+    stats->latency_total += latency;
+    if (latency > stats->latency_max) { stats->latency_max = latency; }
+    stats->done++;
+    if (acked) { stats->acked++; }
+}
+
+/// Return true if a sent frame is waiting for MCPS Confirm
+bool lorawan_stats_pending(const struct lorawan_stats_s *stats) {
+    return stats->done < stats->sent;
+}
+
+/// Print the statistics as one line of JSON. "size" is the payload size,
+/// or 0 if the statistics cover multiple sizes.
+void lorawan_stats_print(const struct lorawan_stats_s *stats, uint8_t size, uint32_t now) {
+    //  Sort the recent send latencies to get the tail latency
+    uint32_t sorted[CONFIG_EXAMPLES_LORAWAN_TEST_LATENCY_SAMPLES];
+    int count = (stats->done < CONFIG_EXAMPLES_LORAWAN_TEST_LATENCY_SAMPLES)
+        ? stats->done
+        : CONFIG_EXAMPLES_LORAWAN_TEST_LATENCY_SAMPLES;
+    memcpy(sorted, stats->latency, count * sizeof(sorted[0]));
+    for (int i = 1; i < count; i++) {
+        uint32_t v = sorted[i];
+        int j = i - 1;
+        for (; j >= 0 && sorted[j] > v; j--) { sorted[j + 1] = sorted[j]; }
+        sorted[j + 1] = v;
+    }
+    uint32_t mean = (stats->done > 0) ? (uint32_t) (stats->latency_total / stats->done) : 0;
+    uint32_t p90  = (count > 0) ? sorted[(count * 9 + 9) / 10 - 1] : 0;  //  Nearest rank
+
+    //  Achieved payload throughput since the first attempt
+    uint32_t elapsed = now - stats->start;
+    uint32_t bytes_per_hour = (elapsed > 0)
+        ? (uint32_t) ((uint64_t) stats->bytes * 3600000 / elapsed)
+        : 0;
+
+    printf("{\"size\":%u,\"attempted\":%lu,\"sent\":%lu,\"done\":%lu,\"acked\":%lu,"
+        "\"bytes\":%lu,\"elapsed_ms\":%lu,\"bytes_per_hour\":%lu,"
+        "\"latency_mean_ms\":%lu,\"latency_p90_ms\":%lu,\"latency_max_ms\":%lu}\n",
+        size, stats->attempted, stats->sent, stats->done, stats->acked,
+        stats->bytes, elapsed, bytes_per_hour,
+        mean, p90, stats->latency_max);
+}
@@ -0,0 +1,55 @@
+//  Uplink Statistics for LoRaWAN Test App.
+//  Counts the frames attempted / sent / acknowledged and the send latency
+//  (LmHandlerSend to MCPS Confirm), and prints a machine-readable summary.
+#ifndef __LORAWAN_STATS_H__
+#define __LORAWAN_STATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <nuttx/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Uplink Statistics
+struct lorawan_stats_s {
+    uint32_t start;      //  Time of the first attempt (milliseconds)
+    uint32_t attempted;  //  Frames that we tried to send
+    uint32_t sent;       //  Frames accepted by LmHandlerSend
+    uint32_t done;       //  Frames confirmed by MCPS Confirm
+    uint32_t acked;      //  Confirmed Frames acknowledged by the network
+    uint32_t bytes;      //  Payload bytes in the sent Frames
+    uint32_t send_time;  //  Time of the last LmHandlerSend (milliseconds)
+    uint64_t latency_total;  //  Sum of send latencies (milliseconds)
+    uint32_t latency_max;    //  Maximum send latency (milliseconds)
+
+    //  Recent send latencies (milliseconds) for computing the tail latency.
+    //  When the samples wrap around, the tail latency covers the most recent frames.
+    uint32_t latency[CONFIG_EXAMPLES_LORAWAN_TEST_LATENCY_SAMPLES];
+};
+
+/// Clear the statistics
+void lorawan_stats_reset(struct lorawan_stats_s *stats);
+
+/// Count an attempt to send a frame at the time "now" (milliseconds)
+void lorawan_stats_attempt(struct lorawan_stats_s *stats, uint32_t now);
+
+/// Count a frame of "size" bytes accepted by LmHandlerSend at the time "now" (milliseconds)
+void lorawan_stats_sent(struct lorawan_stats_s *stats, uint8_t size, uint32_t now);
+
+/// Count the MCPS Confirm of the last frame sent, at the time "now" (milliseconds)
+void lorawan_stats_done(struct lorawan_stats_s *stats, bool acked, uint32_t now);
+
+/// Return true if a sent frame is waiting for MCPS Confirm
+bool lorawan_stats_pending(const struct lorawan_stats_s *stats);
+
+/// Print the statistics as one line of JSON. "size" is the payload size,
+/// or 0 if the statistics cover multiple sizes.
+void lorawan_stats_print(const struct lorawan_stats_s *stats, uint8_t size, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  //  __LORAWAN_STATS_H__
@@ -24,6 +24,10 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
 #include <nuttx/config.h>
 #include <nuttx/random.h>
 #include "firmwareVersion.h"
@@ -32,23 +36,56 @@
 #include "../libs/liblorawan/src/mac/region/RegionCommon.h"
 #include "../libs/liblorawan/src/apps/LoRaMac/common/Commissioning.h"
 #include "../libs/liblorawan/src/apps/LoRaMac/common/LmHandler/LmHandler.h"
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
 #include "../libs/liblorawan/src/apps/LoRaMac/common/LmHandler/packages/LmhpCompliance.h"
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_CLOCK_SYNC
 #include "../libs/liblorawan/src/apps/LoRaMac/common/LmHandler/packages/LmhpClockSync.h"
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_CLOCK_SYNC
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_REMOTE_MCAST
 #include "../libs/liblorawan/src/apps/LoRaMac/common/LmHandler/packages/LmhpRemoteMcastSetup.h"
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_REMOTE_MCAST
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 #include "../libs/liblorawan/src/apps/LoRaMac/common/LmHandler/packages/LmhpFragmentation.h"
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 #include "../libs/liblorawan/src/apps/LoRaMac/common/LmHandlerMsgDisplay.h"
+#include "lorawan_classb.h"
+#include "lorawan_crypto.h"
+#include "lorawan_mem.h"
+#include "lorawan_rxpool.h"
+#include "lorawan_stats.h"
+#include "lorawan_time.h"
+#include "lorawan_trace.h"
 #ifdef CONFIG_LIBBL602_ADC
 #include "../libs/libbl602_adc/bl602_adc.h"
 #include "../libs/libbl602_adc/bl602_glb.h"
 #endif  //  CONFIG_LIBBL602_ADC
 
+//  Select the LoRaWAN Region from the Build Config.
+//  The Region must also be enabled in liblorawan.
 #ifndef ACTIVE_REGION
-
-#warning "No active region defined, LORAMAC_REGION_AS923 will be used as default."
-
+#if defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_AU915)
+#define ACTIVE_REGION LORAMAC_REGION_AU915
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_CN470)
+#define ACTIVE_REGION LORAMAC_REGION_CN470
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_CN779)
+#define ACTIVE_REGION LORAMAC_REGION_CN779
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_EU433)
+#define ACTIVE_REGION LORAMAC_REGION_EU433
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_EU868)
+#define ACTIVE_REGION LORAMAC_REGION_EU868
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_IN865)
+#define ACTIVE_REGION LORAMAC_REGION_IN865
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_KR920)
+#define ACTIVE_REGION LORAMAC_REGION_KR920
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_RU864)
+#define ACTIVE_REGION LORAMAC_REGION_RU864
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_US915)
+#define ACTIVE_REGION LORAMAC_REGION_US915
+#else
 #define ACTIVE_REGION LORAMAC_REGION_AS923
-
-#endif
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_REGION_AU915
+#endif  //  ACTIVE_REGION
 
 /*!
  * LoRaWAN default end-device class
@@ -90,6 +127,67 @@
  */
 #define LORAWAN_APP_DATA_BUFFER_MAX_SIZE            242
 
+/*!
+ * Number of frames processed by the crypto benchmark for each backend
+ */
+#define CRYPTO_BENCH_FRAMES                         1000
+
+/*!
+ * Default number of multicast downlinks injected between each dispatch
+ * by the receive stress test
+ */
+#define RXPOOL_STRESS_BURST                         4
+
+/*!
+ * Application port for the multicast downlinks injected by the receive stress test
+ */
+#define RXPOOL_STRESS_PORT                          200
+
+/*!
+ * Default maximum tolerated rx error in milliseconds
+ */
+#define LORAWAN_DEFAULT_MAX_RX_ERROR                20
+
+/*!
+ * Maximum arrival time jitter of the simulated beacons, in microseconds
+ */
+#define BEACON_SIM_JITTER                           2000
+
+/*!
+ * Datarate of the simulated beacons: the Beacon Datarate of the region
+ */
+#if defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_US915) || defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_AU915)
+#define BEACON_SIM_DR                               DR_8
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_CN470)
+#define BEACON_SIM_DR                               DR_2
+#elif defined(CONFIG_EXAMPLES_LORAWAN_TEST_REGION_IN865)
+#define BEACON_SIM_DR                               DR_4
+#else
+#define BEACON_SIM_DR                               DR_3
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_REGION_US915
+
+/*!
+ * Minimum interval between clock sync requests while a resync is due, in milliseconds
+ */
+#define TIME_SYNC_RETRY                             3600000
+
+/*!
+ * Interval between the simulated uplinks that check for a clock resync, in seconds
+ */
+#define TIME_SIM_UPLINK_PERIOD                      3600
+
+/*!
+ * Number of samples stamped and encoded by the clock sync simulation, and the
+ * interval between samples in milliseconds
+ */
+#define TIME_SIM_SAMPLES                            16
+#define TIME_SIM_SAMPLE_PERIOD                      30000
+
+/*!
+ * LoRaWAN application port
+ */
+#define LORAWAN_APP_PORT                            1
+
 /*!
  * LoRaWAN ETSI duty cycle control enable/disable
  *
@@ -111,6 +209,11 @@ typedef enum
  */
 static uint8_t AppDataBuffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
 
+/*!
+ * User application message, repeated to fill the payload size
+ */
+static const char AppMessage[] = "Hi NuttX";
+
 /*!
  * Timer to handle the application data transmission duty cycle
  */
@@ -131,6 +234,7 @@ static void OnSysTimeUpdate( bool isSynchronized, int32_t timeCorrection );
 #else
 static void OnSysTimeUpdate( void );
 #endif
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 #if( FRAG_DECODER_FILE_HANDLING_NEW_API == 1 )
 static int8_t FragDecoderWrite( uint32_t addr, uint8_t *data, uint32_t size );
 static int8_t FragDecoderRead( uint32_t addr, uint8_t *data, uint32_t size );
@@ -141,20 +245,57 @@ static void OnFragDone( int32_t status, uint32_t size );
 #else
 static void OnFragDone( int32_t status, uint8_t *file, uint32_t size );
 #endif
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 static void StartTxProcess( LmHandlerTxEvents_t txEvent );
 static void UplinkProcess( void );
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
 static void OnTxPeriodicityChanged( uint32_t periodicity );
 static void OnTxFrameCtrlChanged( LmHandlerMsgTypes_t isTxConfirmed );
 static void OnPingSlotPeriodicityChanged( uint8_t pingSlotPeriodicity );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
 
 /*!
  * Function executed on TxTimer event
  */
 static void OnTxTimerEvent( struct ble_npl_event *event );
 
+static int parse_options(int argc, FAR char *argv[]);
 static void init_entropy_pool(void);
 static void handle_event_queue(void *arg);
+static void process_mac_events(void);
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+static void init_rx_frames(void);
+static void run_rx_stress(uint32_t count, uint32_t burst);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+static uint64_t classb_now(void);
+static void run_beacon_sim(uint32_t count, int32_t drift_ppm, uint32_t loss_pct);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+static bool request_time_sync(void);
+static void run_time_sim(uint32_t days, int32_t drift_ppm);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+static void init_mem_report(void);
+static void start_mem_report(void);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+static void trace_rx_data(LmHandlerAppData_t* appData, LmHandlerRxParams_t* params);
+static void trace_tx_data(LmHandlerTxParams_t* params);
+static void trace_beacon(LoRaMacHandlerBeaconParams_t* params);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
+static void replay_trace(void);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
+/// True while replaying the Trace File: the MAC, Radio and Event Queue are not initialised
+static bool IsTraceReplay = false;
+#define IS_TRACE_REPLAY  IsTraceReplay
+#else
+#define IS_TRACE_REPLAY  false
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
 
 uint8_t BoardGetBatteryLevel( void ) { return 0; } //// TODO
 uint32_t BoardGetRandomSeed( void ) { return 22; } //// TODO
@@ -190,6 +331,7 @@ static LmHandlerParams_t LmHandlerParams =
     .PingSlotPeriodicity = REGION_COMMON_DEFAULT_PING_SLOT_PERIODICITY,
 };
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
 static LmhpComplianceParams_t LmhpComplianceParams =
 {
     .FwVersion.Value = FIRMWARE_VERSION,
@@ -197,7 +339,9 @@ static LmhpComplianceParams_t LmhpComplianceParams =
     .OnTxFrameCtrlChanged = OnTxFrameCtrlChanged,
     .OnPingSlotPeriodicityChanged = OnPingSlotPeriodicityChanged,
 };
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 /*!
  * Defines the maximum size for the buffer receiving the fragmentation result.
  *
@@ -232,6 +376,7 @@ static LmhpFragmentationParams_t FragmentationParams =
     .OnProgress = OnFragProgress,
     .OnDone = OnFragDone
 };
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 
 /*!
  * Indicates if LoRaMacProcess call is pending.
@@ -244,6 +389,96 @@ static volatile uint8_t IsTxFramePending = 0;
 
 static volatile uint32_t TxPeriodicity = 0;
 
+/*
+ * Number of frames to send for each payload size, 0 to send forever
+ */
+static uint32_t TxCount = 0;
+
+/*
+ * Payload sizes to send: from TxSizeMin to TxSizeMax in steps of TxSizeStep
+ */
+static uint8_t TxSizeMin = 0;
+static uint8_t TxSizeMax = 0;
+static uint8_t TxSizeStep = 1;
+
+/*
+ * Current payload size and the number of frames attempted at this size
+ */
+static uint8_t TxSize = 0;
+static uint32_t TxSizeCount = 0;
+
+/*
+ * Application port for uplinks
+ */
+static uint8_t TxPort = LORAWAN_APP_PORT;
+
+/*
+ * Indicates if all frames have been sent, which ends the run
+ */
+static volatile bool IsRunDone = false;
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+/*
+ * Indicates if we should run the crypto benchmark instead of joining the network
+ */
+static bool IsCryptoBench = false;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+/*
+ * Number of multicast downlinks to inject for the receive stress test, 0 to disable,
+ * and the number of downlinks injected between each dispatch
+ */
+static uint32_t RxStressCount = 0;
+static uint32_t RxStressBurst = 0;
+
+/*
+ * Indicates if the receive stress test is running: the Event Queue is not
+ * initialised, so the test dispatches the queued frames itself
+ */
+static bool IsRxStress = false;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+
+/*
+ * Device class requested after joining the network
+ */
+static DeviceClass_t DeviceClass = LORAWAN_DEFAULT_CLASS;
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+/*
+ * Maximum tolerated rx error in milliseconds, adapted to the beacon timing
+ */
+static uint32_t MaxRxError = LORAWAN_DEFAULT_MAX_RX_ERROR;
+
+/*
+ * Number of simulated beacons to receive, 0 to disable, with the simulated
+ * clock drift in ppm and the percentage of beacons missed
+ */
+static uint32_t BeaconSimCount = 0;
+static int32_t BeaconSimDrift = 0;
+static uint32_t BeaconSimLoss = 0;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+/*
+ * Local time of the last clock sync request in microseconds, 0 if none
+ */
+static uint64_t TimeSyncRequestTime = 0;
+
+/*
+ * Number of days to simulate clock syncs, 0 to disable, with the simulated
+ * clock drift in ppm
+ */
+static uint32_t TimeSimDays = 0;
+static int32_t TimeSimDrift = 0;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+
+/*
+ * Uplink statistics for the whole run and for the current payload size
+ */
+static struct lorawan_stats_s RunStats;
+static struct lorawan_stats_s SizeStats;
+
 /*
  * Indicates if the system time has been synchronized
  */
@@ -254,6 +489,7 @@ static volatile bool IsClockSynched = false;
  */
 static volatile bool IsMcSessionStarted = false;
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 /*
  * Indicates if the file transfer is done
  */
@@ -263,6 +499,7 @@ static volatile bool IsFileTransferDone = false;
  *  Received file computed CRC32
  */
 static volatile uint32_t FileRxCrc = 0;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 
 /*!
  * Main application entry point.
@@ -277,12 +514,76 @@ int main(int argc, FAR char *argv[]) {
     //  TODO: BoardInitMcu( );
     //  TODO: BoardInitPeriph( );
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+    //  Start the RAM and Stack Instrumentation
+    lorawan_mem_init();
+    init_mem_report();
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+
+    //  Set the Run Mode from the command-line options
+    if (parse_options(argc, argv) < 0) { return 1; }
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+    //  Init the Crypto Backends and print the MIC and Encryption cost per frame.
+    //  The Backends only feed the benchmark, so a failed self-test doesn't stop the LoRaWAN run.
+    int cryptoStatus = lorawan_crypto_init();
+    if (cryptoStatus < 0) { puts("Crypto Backends failed self-test"); }
+    if (IsCryptoBench) {
+        if (cryptoStatus < 0) { return 1; }
+        lorawan_crypto_bench(CRYPTO_BENCH_FRAMES);
+        return 0;
+    }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+    //  Init the Downlink Frame Pool and run the receive stress test if requested
+    init_rx_frames();
+    if (RxStressCount > 0) {
+        run_rx_stress(RxStressCount, RxStressBurst);
+        return 0;
+    }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+    //  Init the Class B Beacon Tracking and run the simulated Beacons if requested
+    lorawan_classb_init(LORAWAN_DEFAULT_MAX_RX_ERROR);
+    lorawan_classb_set_periodicity(LmHandlerParams.PingSlotPeriodicity);
+    MaxRxError = LORAWAN_DEFAULT_MAX_RX_ERROR;
+    if (BeaconSimCount > 0) {
+        run_beacon_sim(BeaconSimCount, BeaconSimDrift, BeaconSimLoss);
+        return 0;
+    }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+    //  Init the Synced Timekeeping and run the simulated clock syncs if requested
+    if (lorawan_time_init(CONFIG_EXAMPLES_LORAWAN_TEST_TIME_MAX_ERROR, CONFIG_EXAMPLES_LORAWAN_TEST_TIME_DRIFT_PPM) < 0) {
+        printf("Maximum time error must exceed %d ms\n", LORAWAN_TIME_SYNC_RESIDUAL);
+        return 1;
+    }
+    TimeSyncRequestTime = 0;
+    if (TimeSimDays > 0) {
+        run_time_sim(TimeSimDays, TimeSimDrift);
+        return 0;
+    }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
+    //  Feed the recorded Trace into the app handlers instead of joining the LoRaWAN Network.
+    //  The MAC and Radio are not initialised, so this runs on sim:nsh without a radio.
+    replay_trace();
+    return 0;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
+
     //  If we are using Entropy Pool and the BL602 ADC is available,
     //  add the Internal Temperature Sensor data to the Entropy Pool
     init_entropy_pool();
 
-    //  Compute the interval between transmissions based on Duty Cycle
-    TxPeriodicity = APP_TX_DUTYCYCLE + randr( -APP_TX_DUTYCYCLE_RND, APP_TX_DUTYCYCLE_RND );
+    //  Compute the interval between transmissions based on Duty Cycle,
+    //  unless the interval was set by the command-line options
+    if (TxPeriodicity == 0) {
+        TxPeriodicity = APP_TX_DUTYCYCLE + randr( -APP_TX_DUTYCYCLE_RND, APP_TX_DUTYCYCLE_RND );
+    }
 
     const Version_t appVersion    = { .Value = FIRMWARE_VERSION };
     const Version_t gitHubVersion = { .Value = GITHUB_VERSION };
@@ -299,26 +600,234 @@ int main(int argc, FAR char *argv[]) {
     }
 
     // Set system maximum tolerated rx error in milliseconds
-    LmHandlerSetSystemMaxRxError( 20 );
+    LmHandlerSetSystemMaxRxError( LORAWAN_DEFAULT_MAX_RX_ERROR );
 
-    // The LoRa-Alliance Compliance protocol package should always be initialized and activated.
+    // Register the LmHandler packages enabled in the Build Config. The LoRa-Alliance
+    // Compliance protocol package is needed for certification, so keep it enabled
+    // unless flash is tight.
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
     LmHandlerPackageRegister( PACKAGE_ID_COMPLIANCE, &LmhpComplianceParams );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_CLOCK_SYNC
     LmHandlerPackageRegister( PACKAGE_ID_CLOCK_SYNC, NULL );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_CLOCK_SYNC
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_REMOTE_MCAST
     LmHandlerPackageRegister( PACKAGE_ID_REMOTE_MCAST_SETUP, NULL );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_REMOTE_MCAST
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
     LmHandlerPackageRegister( PACKAGE_ID_FRAGMENTATION, &FragmentationParams );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 
     IsClockSynched     = false;
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
     IsFileTransferDone = false;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
+
+#if defined(CONFIG_EXAMPLES_LORAWAN_TEST_TRACE) && !defined(CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY)
+    //  Record the Events into the Trace File
+    lorawan_trace_start(CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_FILE);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE && !CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
 
     //  Join the LoRaWAN Network
+    lorawan_mem_phase(LORAWAN_MEM_JOIN);
     LmHandlerJoin( );
 
     //  Set the Transmit Timer
     StartTxProcess( LORAMAC_HANDLER_TX_ON_TIMER );
 
-    //  Handle LoRaWAN Events
-    handle_event_queue(NULL);  //  Never returns
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+    //  Report the RAM and Stack Usage periodically and on SIGUSR1
+    start_mem_report();
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+
+    //  Handle LoRaWAN Events until all frames have been sent.
+    //  Never returns if we are sending forever.
+    handle_event_queue(NULL);
+
+    //  Print the summary for the run
+    TimerStop( &TxTimer );
+    lorawan_stats_print(&RunStats, (TxSizeMin == TxSizeMax) ? TxSize : 0, TimerGetCurrentTime());
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+    lorawan_rxpool_report();
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+    if (DeviceClass == CLASS_B) { lorawan_classb_report(); }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+    lorawan_time_report();
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+    lorawan_mem_report();
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+    lorawan_trace_flush();
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+    return 0;
+}
+
+/// Print the command-line options
+static void print_usage(const char *progname) {
+    printf("Usage: %s [-p period_ms] [-n count] [-s size | -s min:max[:step]] [-d datarate] [-f port] [-k class] [-c] [-C] [-M count[:burst]] [-B count[:drift_ppm[:loss_pct]]] [-T days[:drift_ppm]]\n", progname);
+    puts("  -p period_ms  Interval between uplinks (default: 40 s, randomized by 5 s)");
+    puts("  -n count      Frames to send for each payload size, then print summary and exit (default: send forever)");
+    puts("  -s size       Payload size in bytes (default: 9)");
+    puts("  -s min:max[:step]  Sweep the payload size from min to max bytes");
+    puts("  -d datarate   Uplink datarate DR_0 to DR_15 (default: DR_3)");
+    puts("  -f port       Application port 1 to 223 (default: 1)");
+    puts("  -k class      Device class A, B or C to request after joining (default: A)");
+    puts("  -c            Send confirmed uplinks (default: unconfirmed)");
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+    puts("  -C            Print the MIC and payload encryption cost per frame, then exit");
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+    puts("  -M count[:burst]  Inject back-to-back multicast downlinks, dispatched every burst frames (default: 4), then exit");
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+    puts("  -B count[:drift_ppm[:loss_pct]]  Track simulated Class B beacons with clock drift and beacon loss, then exit");
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+    puts("  -T days[:drift_ppm]  Simulate clock syncs over the days with clock drift, then exit");
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+}
 
+/// Set the Run Mode from the command-line options. Returns 0 if successful.
+static int parse_options(int argc, FAR char *argv[]) {
+    //  Restore the defaults, in case we were run before
+    TxPeriodicity = 0;
+    TxCount       = 0;
+    TxSizeMin     = sizeof(AppMessage);
+    TxSizeMax     = sizeof(AppMessage);
+    TxSizeStep    = 1;
+    TxPort        = LORAWAN_APP_PORT;
+    LmHandlerParams.TxDatarate    = LORAWAN_DEFAULT_DATARATE;
+    LmHandlerParams.IsTxConfirmed = LORAWAN_DEFAULT_CONFIRMED_MSG_STATE;
+    DeviceClass   = LORAWAN_DEFAULT_CLASS;
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+    IsCryptoBench = false;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+    RxStressCount = 0;
+    RxStressBurst = RXPOOL_STRESS_BURST;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+    BeaconSimCount = 0;
+    BeaconSimDrift = 0;
+    BeaconSimLoss  = 0;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+    TimeSimDays  = 0;
+    TimeSimDrift = 0;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:s:d:f:k:cCM:B:T:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                TxPeriodicity = strtoul(optarg, NULL, 0);
+                if (TxPeriodicity == 0) { puts("Invalid period"); return -1; }
+                break;
+
+            case 'n':
+                TxCount = strtoul(optarg, NULL, 0);
+                break;
+
+            case 's': {
+                unsigned min = 0, max = 0, step = 1;
+                int n = sscanf(optarg, "%u:%u:%u", &min, &max, &step);
+                if (n == 1) { max = min; }
+                if (n < 1 || min == 0 || min > max || max > LORAWAN_APP_DATA_BUFFER_MAX_SIZE || step == 0) {
+                    printf("Invalid size, must be 1 to %d bytes\n", LORAWAN_APP_DATA_BUFFER_MAX_SIZE);
+                    return -1;
+                }
+                TxSizeMin  = min;
+                TxSizeMax  = max;
+                TxSizeStep = (step > UINT8_MAX) ? UINT8_MAX : step;
+                break;
+            }
+
+            case 'd': {
+                unsigned long dr = strtoul(optarg, NULL, 0);
+                if (dr > DR_15) { puts("Invalid datarate"); return -1; }
+                LmHandlerParams.TxDatarate = dr;
+                break;
+            }
+
+            case 'f': {
+                unsigned long port = strtoul(optarg, NULL, 0);
+                if (port < 1 || port > 223) { puts("Invalid port"); return -1; }
+                TxPort = port;
+                break;
+            }
+
+            case 'k':
+                if      (optarg[0] == 'A' || optarg[0] == 'a') { DeviceClass = CLASS_A; }
+                else if (optarg[0] == 'B' || optarg[0] == 'b') { DeviceClass = CLASS_B; }
+                else if (optarg[0] == 'C' || optarg[0] == 'c') { DeviceClass = CLASS_C; }
+                else { puts("Invalid class"); return -1; }
+                break;
+
+            case 'c':
+                LmHandlerParams.IsTxConfirmed = LORAMAC_HANDLER_CONFIRMED_MSG;
+                break;
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+            case 'C':
+                IsCryptoBench = true;
+                break;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CRYPTO
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+            case 'M': {
+                unsigned long count = 0, burst = RXPOOL_STRESS_BURST;
+                int n = sscanf(optarg, "%lu:%lu", &count, &burst);
+                if (n < 1 || count == 0 || burst == 0) { puts("Invalid stress count"); return -1; }
+                RxStressCount = count;
+                RxStressBurst = burst;
+                break;
+            }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+            case 'B': {
+                unsigned long count = 0, loss = 0;
+                long drift = 0;
+                int n = sscanf(optarg, "%lu:%ld:%lu", &count, &drift, &loss);
+                if (n < 1 || count == 0 || loss > 100) { puts("Invalid beacon count"); return -1; }
+                BeaconSimCount = count;
+                BeaconSimDrift = drift;
+                BeaconSimLoss  = loss;
+                break;
+            }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+            case 'T': {
+                unsigned long days = 0;
+                long drift = 0;
+                int n = sscanf(optarg, "%lu:%ld", &days, &drift);
+                if (n < 1 || days == 0) { puts("Invalid days"); return -1; }
+                TimeSimDays  = days;
+                TimeSimDrift = drift;
+                break;
+            }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    //  Start the run at the smallest payload size
+    TxSize      = TxSizeMin;
+    TxSizeCount = 0;
+    IsRunDone   = false;
+    lorawan_stats_reset(&RunStats);
+    lorawan_stats_reset(&SizeStats);
+    printf("parse_options: period=%lu ms, count=%lu, size=%u:%u:%u, dr=%d, port=%u, class=%c, confirmed=%d\n",
+        TxPeriodicity, TxCount, TxSizeMin, TxSizeMax, TxSizeStep,
+        LmHandlerParams.TxDatarate, TxPort, 'A' + DeviceClass, LmHandlerParams.IsTxConfirmed);
     return 0;
 }
 
@@ -329,30 +838,54 @@ static void PrepareTxFrame( void )
 {
     //  If we haven't joined the LoRaWAN Network, try again later
     if (LmHandlerIsBusy()) { puts("PrepareTxFrame: Busy"); return; }
+    if (IsRunDone) { return; }
+
+    //  When all frames have been attempted at this payload size,
+    //  move to the next payload size or end the run
+    uint32_t now = TimerGetCurrentTime();
+    if (TxCount > 0 && TxSizeCount >= TxCount) {
+        if (TxSizeMin != TxSizeMax) { lorawan_stats_print(&SizeStats, TxSize, now); }
+        if (TxSize + TxSizeStep > TxSizeMax) { IsRunDone = true; return; }
+        TxSize += TxSizeStep;
+        TxSizeCount = 0;
+        lorawan_stats_reset(&SizeStats);
+    }
+    TxSizeCount++;
+    lorawan_stats_attempt(&RunStats, now);
+    lorawan_stats_attempt(&SizeStats, now);
 
-    //  Send a message to LoRaWAN
-    const char msg[] = "Hi NuttX";
-    printf("PrepareTxFrame: Transmit to LoRaWAN: %s (%d bytes)\n", msg, sizeof(msg));
+    //  Send a message to LoRaWAN, repeated to fill the payload size
+    printf("PrepareTxFrame: Transmit to LoRaWAN: %s (%d bytes)\n", AppMessage, TxSize);
 
     //  Compose the transmit request
-    assert(sizeof(msg) <= sizeof(AppDataBuffer));
-    memcpy(AppDataBuffer, msg, sizeof(msg));
+    assert(TxSize <= sizeof(AppDataBuffer));
+    for (int i = 0; i < TxSize; i++) {
+        AppDataBuffer[i] = AppMessage[i % sizeof(AppMessage)];
+    }
     LmHandlerAppData_t appData =
     {
         .Buffer = AppDataBuffer,
-        .BufferSize = sizeof(msg),
-        .Port = 1,
+        .BufferSize = TxSize,
+        .Port = TxPort,
     };
 
-    //  Validate the message size and check if it can be transmitted
+    //  Validate the message size and check if it can be transmitted.
+    //  Payload size sweeps may exceed the maximum size for the datarate.
     LoRaMacTxInfo_t txInfo;
     LoRaMacStatus_t status = LoRaMacQueryTxPossible(appData.BufferSize, &txInfo);
     printf("PrepareTxFrame: status=%d, maxSize=%d, currentSize=%d\n", status, txInfo.MaxPossibleApplicationDataSize, txInfo.CurrentPossiblePayloadSize);
-    assert(status == LORAMAC_STATUS_OK);
+    if (status != LORAMAC_STATUS_OK) { puts("PrepareTxFrame: Transmit not possible"); return; }
 
-    //  Transmit the message
+    //  Transmit the message. The Uplink Phase covers the stack used by LmHandlerSend.
+    lorawan_mem_phase(LORAWAN_MEM_UPLINK);
     LmHandlerErrorStatus_t sendStatus = LmHandlerSend( &appData, LmHandlerParams.IsTxConfirmed );
-    assert(sendStatus == LORAMAC_HANDLER_SUCCESS);
+    if (sendStatus != LORAMAC_HANDLER_SUCCESS) {
+        lorawan_mem_phase(LORAWAN_MEM_IDLE);
+        puts("PrepareTxFrame: Transmit failed");
+        return;
+    }
+    lorawan_stats_sent(&RunStats, TxSize, now);
+    lorawan_stats_sent(&SizeStats, TxSize, now);
     puts("PrepareTxFrame: Transmit OK");
 }
 
@@ -388,6 +921,10 @@ static void UplinkProcess( void )
     CRITICAL_SECTION_END( );
     if( isPending == 1 )
     {
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+        //  Send the clock sync request instead of our uplink, only when the predicted time error is too high
+        if( request_time_sync( ) ) { return; }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
         PrepareTxFrame( );
     }
 }
@@ -401,10 +938,14 @@ static void UplinkProcess( void )
 static void OnTxTimerEvent( struct ble_npl_event *event )
 {
     printf("OnTxTimerEvent: timeout in %ld ms, event=%p\n", TxPeriodicity, event);
-    TimerStop( &TxTimer );
-
+    lorawan_trace(LORAWAN_TRACE_TIMER_FIRE, 0, 0, TxPeriodicity);
+    lorawan_trace_kind(LORAWAN_TRACE_EV_TX_TIMER);
     IsTxFramePending = 1;
 
+    //  During replay the TxTimer is not initialised and nothing drains the Event Queue
+    if( IS_TRACE_REPLAY ) { return; }
+    TimerStop( &TxTimer );
+
     // Schedule next transmission
     TimerSetValue( &TxTimer, TxPeriodicity );
     TimerStart( &TxTimer );
@@ -412,58 +953,113 @@ static void OnTxTimerEvent( struct ble_npl_event *event )
 
 static void OnMacProcessNotify( void )
 {
+    //  Called by the MAC on Radio IRQs (TxDone, RxDone, Timeouts, Errors) and MAC Timers
+    lorawan_trace(LORAWAN_TRACE_RADIO_IRQ, 0, 0, 0);
     IsMacProcessPending = 1;
 }
 
 static void OnNvmDataChange( LmHandlerNvmContextStates_t state, uint16_t size )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_NVM_DATA_CHANGE, size, state);
     DisplayNvmDataChange( state, size );
 }
 
 static void OnNetworkParametersChange( CommissioningParams_t* params )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_NETWORK_PARAMS, 0, 0);
     DisplayNetworkParametersUpdate( params );
 }
 
 static void OnMacMcpsRequest( LoRaMacStatus_t status, McpsReq_t *mcpsReq, TimerTime_t nextTxIn )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_MCPS_REQUEST, status, nextTxIn);
     DisplayMacMcpsRequestUpdate( status, mcpsReq, nextTxIn );
 }
 
 static void OnMacMlmeRequest( LoRaMacStatus_t status, MlmeReq_t *mlmeReq, TimerTime_t nextTxIn )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_MLME_REQUEST, status, nextTxIn);
     DisplayMacMlmeRequestUpdate( status, mlmeReq, nextTxIn );
 }
 
 static void OnJoinRequest( LmHandlerJoinParams_t* params )
 {
     puts("OnJoinRequest");
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_JOIN_REQUEST, 0, params->Status);
     DisplayJoinRequestUpdate( params );
     if( params->Status == LORAMAC_HANDLER_ERROR )
     {
+        lorawan_mem_sample();
         LmHandlerJoin( );
     }
     else
     {
-        LmHandlerRequestClass( LORAWAN_DEFAULT_CLASS );
+        lorawan_mem_phase(LORAWAN_MEM_IDLE);
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+        //  Count the Beacon acquisition latency from the Class B request
+        if( DeviceClass == CLASS_B ) { lorawan_classb_request( classb_now( ) ); }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+        LmHandlerRequestClass( DeviceClass );
     }
 }
 
 static void OnTxData( LmHandlerTxParams_t* params )
 {
     puts("OnTxData");
-    DisplayTxUpdate( params );
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+    trace_tx_data( params );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+    //  DisplayTxUpdate reads the Channel Plan from the MAC, which is not initialised during replay
+    if( !IS_TRACE_REPLAY ) { DisplayTxUpdate( params ); }
+
+    //  Count the send latency of our uplink
+    if( params->IsMcpsConfirm != 0 )
+    {
+        bool acked = ( params->MsgType == LORAMAC_HANDLER_CONFIRMED_MSG ) && ( params->AckReceived != 0 );
+        uint32_t now = TimerGetCurrentTime();
+        lorawan_stats_done(&RunStats, acked, now);
+        lorawan_stats_done(&SizeStats, acked, now);
+        lorawan_mem_phase(LORAWAN_MEM_IDLE);
+    }
 }
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+static void queue_rx_frame( LmHandlerAppData_t* appData, LmHandlerRxParams_t* params );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+
 static void OnRxData( LmHandlerAppData_t* appData, LmHandlerRxParams_t* params )
 {
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+    trace_rx_data( appData, params );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+    if( params->RxSlot == RX_SLOT_WIN_CLASS_B_PING_SLOT )
+    {
+        lorawan_classb_ping_rx( );
+    }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+    //  Multicast downlinks may arrive back to back, so we don't display them.
+    //  Queue the downlink and process it in the Event Loop after the MAC Callback.
+    bool isMulticast = ( params->RxSlot == RX_SLOT_WIN_CLASS_C_MULTICAST ) ||
+                       ( params->RxSlot == RX_SLOT_WIN_CLASS_B_MULTICAST_SLOT );
+    if( !isMulticast )
+    {
+        puts("OnRxData");
+        DisplayRxUpdate( appData, params );
+    }
+    queue_rx_frame( appData, params );
+#else
     puts("OnRxData");
     DisplayRxUpdate( appData, params );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+    lorawan_mem_sample();
 }
 
 static void OnClassChange( DeviceClass_t deviceClass )
 {
     puts("OnClassChange");
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_CLASS_CHANGE, 0, deviceClass);
     DisplayClassUpdate( deviceClass );
 
     switch( deviceClass )
@@ -495,8 +1091,25 @@ static void OnClassChange( DeviceClass_t deviceClass )
     }
 }
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+static uint32_t track_beacon( LoRaMacHandlerBeaconParams_t* params, uint64_t now );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+
 static void OnBeaconStatusChange( LoRaMacHandlerBeaconParams_t* params )
 {
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+    trace_beacon( params );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+    //  Widen or narrow the RX windows for the Beacons and Ping Slots
+    uint32_t maxRxError = track_beacon( params, classb_now( ) );
+    if( maxRxError != MaxRxError )
+    {
+        printf("OnBeaconStatusChange: max rx error %lu ms\n", maxRxError);
+        MaxRxError = maxRxError;
+        if( !IS_TRACE_REPLAY ) { LmHandlerSetSystemMaxRxError( maxRxError ); }
+    }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
     switch( params->State )
     {
         case LORAMAC_HANDLER_BEACON_RX:
@@ -526,15 +1139,31 @@ static void OnBeaconStatusChange( LoRaMacHandlerBeaconParams_t* params )
 #if( LMH_SYS_TIME_UPDATE_NEW_API == 1 )
 static void OnSysTimeUpdate( bool isSynchronized, int32_t timeCorrection )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_SYS_TIME_UPDATE, isSynchronized, timeCorrection);
     IsClockSynched = isSynchronized;
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+    //  Take the corrected System Time as the GPS-epoch base
+    SysTime_t sysTime = SysTimeGet( );
+    uint64_t gpsTime = (uint64_t) ( sysTime.Seconds - LORAWAN_TIME_GPS_EPOCH_OFFSET ) * 1000 + sysTime.SubSeconds;
+    lorawan_time_sync( gpsTime, timeCorrection, lorawan_time_local( ) );
+    printf("OnSysTimeUpdate: correction=%ld s, gps=%llu ms\n", timeCorrection, gpsTime);
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
 }
 #else
 static void OnSysTimeUpdate( void )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_SYS_TIME_UPDATE, true, 0);
     IsClockSynched = true;
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+    //  The old API doesn't pass the correction, so the drift can't be measured
+    SysTime_t sysTime = SysTimeGet( );
+    uint64_t gpsTime = (uint64_t) ( sysTime.Seconds - LORAWAN_TIME_GPS_EPOCH_OFFSET ) * 1000 + sysTime.SubSeconds;
+    lorawan_time_sync( gpsTime, 0, lorawan_time_local( ) );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
 }
 #endif
 
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
 #if( FRAG_DECODER_FILE_HANDLING_NEW_API == 1 )
 static int8_t FragDecoderWrite( uint32_t addr, uint8_t *data, uint32_t size )
 {
@@ -565,6 +1194,9 @@ static int8_t FragDecoderRead( uint32_t addr, uint8_t *data, uint32_t size )
 
 static void OnFragProgress( uint16_t fragCounter, uint16_t fragNb, uint8_t fragSize, uint16_t fragNbLost )
 {
+    const uint16_t fragParams[4] = { fragCounter, fragNb, fragSize, fragNbLost };
+    lorawan_trace_data(LORAWAN_TRACE_CB_FRAG_PROGRESS, fragCounter, fragParams, sizeof(fragParams));
+    lorawan_mem_phase(LORAWAN_MEM_FRAG);
     printf( "\n###### =========== FRAG_DECODER ============ ######\n" );
     printf( "######               PROGRESS                ######\n");
     printf( "###### ===================================== ######\n");
@@ -576,6 +1208,8 @@ static void OnFragProgress( uint16_t fragCounter, uint16_t fragNb, uint8_t fragS
 #if( FRAG_DECODER_FILE_HANDLING_NEW_API == 1 )
 static void OnFragDone( int32_t status, uint32_t size )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_FRAG_DONE, (uint16_t) status, size);
+    lorawan_mem_phase(LORAWAN_MEM_IDLE);
     FileRxCrc = Crc32( UnfragmentedData, size );
     IsFileTransferDone = true;
 
@@ -588,6 +1222,8 @@ static void OnFragDone( int32_t status, uint32_t size )
 #else
 static void OnFragDone( int32_t status, uint8_t *file, uint32_t size )
 {
+    lorawan_trace(LORAWAN_TRACE_CALLBACK, LORAWAN_TRACE_CB_FRAG_DONE, (uint16_t) status, size);
+    lorawan_mem_phase(LORAWAN_MEM_IDLE);
     FileRxCrc = Crc32( file, size );
     IsFileTransferDone = true;
     // Switch LED 3 OFF
@@ -601,6 +1237,9 @@ static void OnFragDone( int32_t status, uint8_t *file, uint32_t size )
 }
 #endif
 
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
 static void OnTxPeriodicityChanged( uint32_t periodicity )
 {
     TxPeriodicity = periodicity;
@@ -624,7 +1263,11 @@ static void OnTxFrameCtrlChanged( LmHandlerMsgTypes_t isTxConfirmed )
 static void OnPingSlotPeriodicityChanged( uint8_t pingSlotPeriodicity )
 {
     LmHandlerParams.PingSlotPeriodicity = pingSlotPeriodicity;
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+    lorawan_classb_set_periodicity( pingSlotPeriodicity );
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
 }
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_COMPLIANCE
 
 ///////////////////////////////////////////////////////////////////////////////
 //  Event Queue
@@ -633,8 +1276,8 @@ static void OnPingSlotPeriodicityChanged( uint8_t pingSlotPeriodicity )
 static void handle_event_queue(void *arg) {
     puts("handle_event_queue");
 
-    //  Loop forever handling Events from the Event Queue
-    for (;;) {
+    //  Loop handling Events from the Event Queue until the run is done
+    while (!IsRunDone) {
         //  Get the next Event from the Event Queue
         struct ble_npl_event *ev = ble_npl_eventq_get(
             &event_queue,         //  Event Queue
@@ -645,6 +1288,7 @@ static void handle_event_queue(void *arg) {
         //  Should never happen since we wait forever for an Event.
         if (ev == NULL) { printf("."); continue; }
         printf("handle_event_queue: ev=%p\n", ev);
+        lorawan_trace_loop_start();
 
         //  Remove the Event from the Event Queue
         ble_npl_eventq_remove(&event_queue, ev);
@@ -652,29 +1296,646 @@ static void handle_event_queue(void *arg) {
         //  Trigger the Event Handler Function
         ble_npl_event_run(ev);
 
-        // Processes the LoRaMac events
-        LmHandlerProcess( );
+        //  Process the LoRaMac Events and do the uplink
+        process_mac_events();
+        lorawan_mem_sample();
+        lorawan_trace_loop_done();
+    }
+}
+
+/// Process the LoRaMac Events after an Event has been handled
+static void process_mac_events(void) {
+    // Processes the LoRaMac events
+    LmHandlerProcess( );
+
+    // If we have joined the network, do the uplink
+    if (!LmHandlerIsBusy( )) {
+        UplinkProcess( );
+    }
+
+    CRITICAL_SECTION_BEGIN( );
+    if( IsMacProcessPending == 1 )
+    {
+        // Clear flag and prevent MCU to go into low power modes.
+        IsMacProcessPending = 0;
+    }
+    else
+    {
+        //  The MCU wakes up through events
+        //  TODO: BoardLowPowerHandler( );
+    }
+    CRITICAL_SECTION_END( );
+}
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+///////////////////////////////////////////////////////////////////////////////
+//  Downlink Frames
+
+/// Event to dispatch the queued Downlink Frames
+static struct ble_npl_event rx_frame_event;
+
+/// True if rx_frame_event is in the Event Queue
+static bool rx_frame_event_queued = false;
 
-        // If we have joined the network, do the uplink
-        if (!LmHandlerIsBusy( )) {
-            UplinkProcess( );
+/// Payload bytes received by the application
+static uint32_t rx_frame_bytes = 0;
+
+/// Handle a Downlink Frame. The Frame is passed by reference and returns to the
+/// Frame Pool after this function returns. This only counts the payload bytes:
+/// LmHandler packages (e.g. Fragmentation for FUOTA) have already consumed their
+/// frames inside the MAC Callback, before OnRxData is called.
+static void handle_rx_frame(struct lorawan_rxframe_s *frame) {
+    rx_frame_bytes += frame->size;
+}
+
+/// Handle the Event to dispatch the queued Downlink Frames, after the Event has
+/// been removed from the Event Queue
+static void handle_rx_frame_event(struct ble_npl_event *ev) {
+    lorawan_trace_kind(LORAWAN_TRACE_EV_RX_FRAME);
+    rx_frame_event_queued = false;
+    lorawan_rxpool_dispatch();
+}
+
+/// Init the Downlink Frame Pool and register the application as Consumer
+static void init_rx_frames(void) {
+    lorawan_rxpool_init();
+    lorawan_rxpool_register(0, handle_rx_frame);
+    rx_frame_bytes = 0;
+    rx_frame_event_queued = false;
+    ble_npl_event_init(
+        &rx_frame_event,        //  Event
+        handle_rx_frame_event,  //  Event Handler Function
+        NULL                    //  Argument to be passed to Event Handler
+    );
+}
+
+/// Copy the Downlink from the MAC into the Frame Pool and enqueue the Event to dispatch it
+static void queue_rx_frame( LmHandlerAppData_t* appData, LmHandlerRxParams_t* params )
+{
+    int rc = lorawan_rxpool_put( appData->Port, params->RxSlot, params->DownlinkCounter,
+        params->Rssi, params->Snr, appData->Buffer, appData->BufferSize );
+    if( rc < 0 ) { puts("queue_rx_frame: Frame Pool exhausted, frame dropped"); }
+
+    //  During replay and the stress test the Event Queue is not initialised:
+    //  the Frames are dispatched by the replayed RX Frame Event or the stress test
+    if( !rx_frame_event_queued && !IS_TRACE_REPLAY && !IsRxStress )
+    {
+        rx_frame_event_queued = true;
+        ble_npl_eventq_put( &event_queue, &rx_frame_event );
+    }
+}
+
+/// For Testing: Inject back-to-back Multicast Downlinks through OnRxData and dispatch
+/// the queued Frames after every burst. Every 100th FCnt is skipped to check the
+/// FCnt gap detection.
+static void run_rx_stress(uint32_t count, uint32_t burst) {
+    printf("run_rx_stress: count=%lu, burst=%lu\n", count, burst);
+    static uint8_t payload[LORAWAN_RXFRAME_SIZE];
+    for (int i = 0; i < sizeof(payload); i++) { payload[i] = i; }
+
+    LmHandlerAppData_t appData =
+    {
+        .Buffer = payload,
+        .BufferSize = 50,  //  Typical FUOTA Fragment Size
+        .Port = RXPOOL_STRESS_PORT,
+    };
+    LmHandlerRxParams_t params =
+    {
+        .IsMcpsIndication = 1,
+        .Status = LORAMAC_EVENT_INFO_STATUS_OK,
+        .RxSlot = RX_SLOT_WIN_CLASS_C_MULTICAST,
+    };
+
+    //  The Event Queue is not initialised before LmHandlerInit, so dispatch the Frames here
+    struct timespec start, end;
+    IsRxStress = true;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t fcnt = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        params.DownlinkCounter = fcnt;
+        fcnt += (i % 100 == 99) ? 2 : 1;
+        OnRxData( &appData, &params );
+        if (i % burst == burst - 1) { lorawan_rxpool_dispatch(); }
+    }
+    lorawan_rxpool_dispatch();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    IsRxStress = false;
+
+    uint32_t elapsed = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    printf("run_rx_stress: %lu frames, %lu bytes consumed in %lu us (%lu ns per frame)\n",
+        count, rx_frame_bytes, elapsed, (uint32_t) ((uint64_t) elapsed * 1000 / count));
+    lorawan_rxpool_report();
+}
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+///////////////////////////////////////////////////////////////////////////////
+//  Class B Beacons
+
+/// Return the local time in microseconds
+static uint64_t classb_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// Track the Beacon received or missed at the local time "now" (microseconds).
+/// Returns the maximum RX timing error (milliseconds) for the next Beacon and Ping Slots.
+static uint32_t track_beacon( LoRaMacHandlerBeaconParams_t* params, uint64_t now )
+{
+    switch( params->State )
+    {
+        case LORAMAC_HANDLER_BEACON_RX:
+            return lorawan_classb_beacon_rx( params->Info.Time.Seconds, now, params->Info.Datarate );
+        case LORAMAC_HANDLER_BEACON_NRX:
+            return lorawan_classb_beacon_missed( );
+        case LORAMAC_HANDLER_BEACON_LOST:
+            return lorawan_classb_beacon_lost( now );
+        default:
+            return MaxRxError;
+    }
+}
+
+/// For Testing: Track simulated Beacons from a Gateway, with our clock "drift_ppm" faster
+/// than the Gateway clock and random arrival time jitter. "loss_pct" percent of the Beacons are missed.
+/// The first Beacon arrives at a random time within one Beacon Period of the Class B request.
+static void run_beacon_sim(uint32_t count, int32_t drift_ppm, uint32_t loss_pct) {
+    printf("run_beacon_sim: count=%lu, drift=%ld ppm, loss=%lu%%, periodicity=%u\n",
+        count, drift_ppm, loss_pct, LmHandlerParams.PingSlotPeriodicity);
+    LoRaMacHandlerBeaconParams_t params =
+    {
+        .Info.Datarate = BEACON_SIM_DR,
+    };
+
+    //  GPS time of the first Beacon is a multiple of the Beacon Period
+    const uint32_t gps_start = 1300000000 / LORAWAN_CLASSB_BEACON_PERIOD * LORAWAN_CLASSB_BEACON_PERIOD;
+    const uint64_t period_us = (uint64_t) LORAWAN_CLASSB_BEACON_PERIOD * 1000000;
+    const uint64_t offset_us = (uint64_t) randr( 0, LORAWAN_CLASSB_BEACON_PERIOD * 1000 ) * 1000;
+    lorawan_classb_request(0);
+
+    uint32_t changes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        //  Local time of the Beacon, drifted and jittered
+        int64_t drift_us = (int64_t) (period_us * i) * drift_ppm / 1000000;
+        int64_t now = (int64_t) (offset_us + period_us * i) + drift_us
+            + randr( -BEACON_SIM_JITTER, BEACON_SIM_JITTER );
+        if (now < 0) { now = 0; }  //  Jitter may put the first Beacon before the request
+
+        //  The first Beacon is always received, to end the acquisition
+        params.State = (i > 0 && randr( 0, 99 ) < (int32_t) loss_pct)
+            ? LORAMAC_HANDLER_BEACON_NRX
+            : LORAMAC_HANDLER_BEACON_RX;
+        params.Info.Time.Seconds = gps_start + i * LORAWAN_CLASSB_BEACON_PERIOD;
+
+        uint32_t maxRxError = track_beacon( &params, (uint64_t) now );
+        if (maxRxError != MaxRxError) { MaxRxError = maxRxError; changes++; }
+    }
+    printf("run_beacon_sim: max rx error changed %lu times, now %lu ms\n", changes, MaxRxError);
+    lorawan_classb_report();
+}
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_CLASSB
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+///////////////////////////////////////////////////////////////////////////////
+//  Clock Sync
+
+/// Request a clock sync if the predicted time error exceeds the threshold, at most
+/// once every TIME_SYNC_RETRY. Returns true if the request was sent.
+static bool request_time_sync(void) {
+    if (LmHandlerIsBusy()) { return false; }
+    uint64_t now = lorawan_time_local();
+    if (!lorawan_time_resync_due(now)) { return false; }
+    if (TimeSyncRequestTime != 0 && now - TimeSyncRequestTime < (uint64_t) TIME_SYNC_RETRY * 1000) { return false; }
+
+    printf("request_time_sync: predicted error %lu ms\n", lorawan_time_error(now));
+    if (LmhpClockSyncAppTimeReq() != LORAMAC_HANDLER_SUCCESS) { return false; }
+    TimeSyncRequestTime = now;
+    return true;
+}
+
+/// For Testing: Simulate the clock syncs over "days" with a local oscillator that is
+/// "drift_ppm" fast. Uplinks are sent every TIME_SIM_UPLINK_PERIOD and request a clock sync
+/// only when the predicted time error exceeds the threshold. The clock sync answers are
+/// rounded to whole seconds, like LmhpClockSync. Then stamp and encode some samples.
+static void run_time_sim(uint32_t days, int32_t drift_ppm) {
+    printf("run_time_sim: days=%lu, drift=%ld ppm, max error=%d ms\n",
+        days, drift_ppm, CONFIG_EXAMPLES_LORAWAN_TEST_TIME_MAX_ERROR);
+    const uint64_t gps_start = 1300000000000ULL;  //  GPS time at the start (milliseconds)
+    const uint64_t end = (uint64_t) days * 86400 * 1000000;
+    int64_t sys_offset = randr( -30000, 30000 );  //  System Time error before the first sync (milliseconds)
+    uint32_t uplinks = 0, max_error = 0;
+
+    for (uint64_t local = 0; local <= end; local += (uint64_t) TIME_SIM_UPLINK_PERIOD * 1000000) {
+        //  True GPS time and the System Time, which runs on the local oscillator
+        int64_t local_ms = local / 1000;
+        int64_t gps = gps_start + local_ms - local_ms * drift_ppm / 1000000;
+        int64_t sys_time = gps_start + sys_offset + local_ms;
+        uplinks++;
+
+        //  Error of our timestamps against the true GPS time
+        if (lorawan_time_synced()) {
+            int64_t error = (int64_t) lorawan_time_gps(local) - gps;
+            if (error < 0) { error = -error; }
+            if (error > max_error) { max_error = error; }
         }
 
-        CRITICAL_SECTION_BEGIN( );
-        if( IsMacProcessPending == 1 )
-        {
-            // Clear flag and prevent MCU to go into low power modes.
-            IsMacProcessPending = 0;
+        //  Sync the clock with the correction rounded to whole seconds
+        if (lorawan_time_resync_due(local)) {
+            int64_t diff = gps - sys_time;
+            int32_t correction = (diff + (diff < 0 ? -500 : 500)) / 1000;
+            sys_offset += (int64_t) correction * 1000;
+            lorawan_time_sync(sys_time + (int64_t) correction * 1000, correction, local);
         }
-        else
-        {
-            //  The MCU wakes up through events
-            //  TODO: BoardLowPowerHandler( );
+    }
+    printf("run_time_sim: %lu uplinks, max timestamp error %lu ms\n", uplinks, max_error);
+    lorawan_time_report();
+
+    //  Stamp the samples and encode them against one base
+    uint64_t stamps[TIME_SIM_SAMPLES];
+    for (int i = 0; i < TIME_SIM_SAMPLES; i++) {
+        stamps[i] = lorawan_time_gps(end + (uint64_t) i * TIME_SIM_SAMPLE_PERIOD * 1000);
+    }
+    uint8_t buf[LORAWAN_TIME_BASE_SIZE + 2 * TIME_SIM_SAMPLES];
+    int len = lorawan_time_encode(buf, sizeof(buf), stamps, TIME_SIM_SAMPLES);
+    printf("run_time_sim: %d samples encoded in %d bytes, instead of %d bytes with absolute timestamps\n",
+        TIME_SIM_SAMPLES, len, TIME_SIM_SAMPLES * (int) sizeof(uint32_t));
+}
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TIME
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+///////////////////////////////////////////////////////////////////////////////
+//  RAM and Stack Report
+
+/// Timer to report the RAM and Stack Usage periodically
+static TimerEvent_t MemReportTimer;
+
+/// Event to report the RAM and Stack Usage, enqueued on SIGUSR1
+static struct ble_npl_event mem_report_event;
+
+/// Register the Static RAM of each Subsystem and set up the RAM and Stack Report
+static void init_mem_report(void) {
+    lorawan_mem_register("mac_nvm", sizeof(LoRaMacNvmData_t));
+    lorawan_mem_register("app_buffers", sizeof(AppDataBuffer));
+    lorawan_mem_register("stats", sizeof(RunStats) + sizeof(SizeStats));
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
+    lorawan_mem_register("frag_buffer", sizeof(UnfragmentedData));
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+    lorawan_mem_register("trace_buffer",
+        CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_RECORDS * sizeof(struct lorawan_trace_rec_s));
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+    lorawan_mem_register("rx_pool",
+        CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL_FRAMES * sizeof(struct lorawan_rxframe_s));
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+}
+
+/// Handle the Event to report the RAM and Stack Usage
+static void handle_mem_report_event(struct ble_npl_event *ev) {
+    lorawan_trace_kind(LORAWAN_TRACE_EV_MEM_REPORT);
+    lorawan_mem_report();
+}
+
+/// Function executed on MemReportTimer event
+static void OnMemReportTimerEvent( struct ble_npl_event *event )
+{
+    lorawan_trace_kind(LORAWAN_TRACE_EV_MEM_REPORT);
+    lorawan_mem_report();
+
+    // Schedule next report
+    TimerStop( &MemReportTimer );
+    TimerSetValue( &MemReportTimer, CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT_PERIOD * 1000 );
+    TimerStart( &MemReportTimer );
+}
+
+/// Handle SIGUSR1 from NSH by enqueueing the report into the Event Queue,
+/// so that the report is printed by the Event Loop
+static void handle_sigusr1(int signo) {
+    ble_npl_eventq_put(&event_queue, &mem_report_event);
+}
+
+/// Start reporting the RAM and Stack Usage periodically and on SIGUSR1
+static void start_mem_report(void) {
+    ble_npl_event_init(
+        &mem_report_event,        //  Event
+        handle_mem_report_event,  //  Event Handler Function
+        NULL                      //  Argument to be passed to Event Handler
+    );
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handle_sigusr1;
+    sigaction(SIGUSR1, &act, NULL);
+
+    if (CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT_PERIOD > 0) {
+        TimerInit( &MemReportTimer, OnMemReportTimerEvent );
+        TimerSetValue( &MemReportTimer, CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT_PERIOD * 1000 );
+        TimerStart( &MemReportTimer );
+    }
+}
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+///////////////////////////////////////////////////////////////////////////////
+//  Trace Capture
+
+/// Record the RX Data Callback with the Payload, so that it can be replayed
+static void trace_rx_data(LmHandlerAppData_t* appData, LmHandlerRxParams_t* params) {
+    static uint8_t buf[sizeof(struct lorawan_trace_rx_s) + LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+    struct lorawan_trace_rx_s rx = {
+        .port       = appData->Port,
+        .indication = params->IsMcpsIndication,
+        .status     = params->Status,
+        .datarate   = params->Datarate,
+        .rssi       = params->Rssi,
+        .snr        = params->Snr,
+        .rx_slot    = params->RxSlot,
+    };
+    uint8_t size = (appData->Buffer != NULL) ? appData->BufferSize : 0;
+    memcpy(buf, &rx, sizeof(rx));
+    memcpy(buf + sizeof(rx), appData->Buffer, size);
+    lorawan_trace_data(LORAWAN_TRACE_CB_RX_DATA, params->DownlinkCounter, buf, sizeof(rx) + size);
+}
+
+/// Record the TX Data Callback with the Payload, so that it can be replayed
+static void trace_tx_data(LmHandlerTxParams_t* params) {
+    static uint8_t buf[sizeof(struct lorawan_trace_tx_s) + LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+    struct lorawan_trace_tx_s tx = {
+        .port     = params->AppData.Port,
+        .confirm  = params->IsMcpsConfirm,
+        .status   = params->Status,
+        .msg_type = params->MsgType,
+        .ack      = params->AckReceived,
+        .datarate = params->Datarate,
+        .tx_power = params->TxPower,
+        .channel  = params->Channel,
+    };
+    uint8_t size = (params->AppData.Buffer != NULL) ? params->AppData.BufferSize : 0;
+    memcpy(buf, &tx, sizeof(tx));
+    memcpy(buf + sizeof(tx), params->AppData.Buffer, size);
+    lorawan_trace_data(LORAWAN_TRACE_CB_TX_DATA, params->UplinkCounter, buf, sizeof(tx) + size);
+}
+
+/// Record the Beacon Status Callback, so that it can be replayed
+static void trace_beacon(LoRaMacHandlerBeaconParams_t* params) {
+    struct lorawan_trace_beacon_s beacon = {
+        .frequency = params->Info.Frequency,
+        .rssi      = params->Info.Rssi,
+        .state     = params->State,
+        .datarate  = params->Info.Datarate,
+        .snr       = params->Info.Snr,
+    };
+    lorawan_trace_data(LORAWAN_TRACE_CB_BEACON_STATUS, params->Info.Time.Seconds, &beacon, sizeof(beacon));
+}
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
+///////////////////////////////////////////////////////////////////////////////
+//  Trace Replay
+
+/// Names of the Event Kinds
+static const char *const replay_event_names[LORAWAN_TRACE_NUM_EVENTS] = {
+    "mac", "tx_timer", "rx_frame", "mem_report"
+};
+
+/// Replayed Event Loop latency for each Event Kind (microseconds)
+struct replay_stats_s {
+    uint32_t loops;        //  Event Loop iterations
+    uint64_t latency;      //  Total latency
+    uint32_t latency_max;  //  Maximum latency
+};
+static struct replay_stats_s replay_stats[LORAWAN_TRACE_NUM_EVENTS];
+
+/// Total and maximum Event Loop latency in the recording (microseconds)
+static uint32_t recorded_loops = 0;
+static uint64_t recorded_latency = 0;
+static uint32_t recorded_latency_max = 0;
+
+/// Time spent in the application handlers during the current Event Loop iteration (microseconds)
+static uint32_t replay_busy = 0;
+
+/// Number of Callbacks replayed, and not replayed because they drive the MAC
+static uint32_t replay_callbacks = 0;
+static uint32_t skipped_callbacks = 0;
+
+/// Equivalent of the TxTimer Event
+static struct ble_npl_event replay_timer_event;
+
+/// Feed a recorded Callback into the application handler.
+/// Returns false if the Callback is not replayed.
+static bool replay_callback(const struct lorawan_trace_rec_s *rec, const uint8_t *data) {
+    bool hasData = (rec->type & LORAWAN_TRACE_HAS_DATA) != 0;
+    switch (rec->sub) {
+        case LORAWAN_TRACE_CB_RX_DATA: {
+            struct lorawan_trace_rx_s rx;
+            if (!hasData || rec->aux < sizeof(rx)) { return false; }
+            memcpy(&rx, data, sizeof(rx));
+            LmHandlerAppData_t appData =
+            {
+                .Buffer = (uint8_t *) data + sizeof(rx),
+                .BufferSize = rec->aux - sizeof(rx),
+                .Port = rx.port,
+            };
+            LmHandlerRxParams_t params =
+            {
+                .IsMcpsIndication = rx.indication,
+                .Status = rx.status,
+                .Datarate = rx.datarate,
+                .Rssi = rx.rssi,
+                .Snr = rx.snr,
+                .DownlinkCounter = rec->arg,
+                .RxSlot = rx.rx_slot,
+            };
+            OnRxData( &appData, &params );
+            return true;
+        }
+
+        case LORAWAN_TRACE_CB_TX_DATA: {
+            struct lorawan_trace_tx_s tx;
+            if (!hasData || rec->aux < sizeof(tx)) { return false; }
+            memcpy(&tx, data, sizeof(tx));
+            LmHandlerTxParams_t params =
+            {
+                .IsMcpsConfirm = tx.confirm,
+                .Status = tx.status,
+                .MsgType = tx.msg_type,
+                .AckReceived = tx.ack,
+                .Datarate = tx.datarate,
+                .UplinkCounter = rec->arg,
+                .AppData =
+                {
+                    .Buffer = (uint8_t *) data + sizeof(tx),
+                    .BufferSize = rec->aux - sizeof(tx),
+                    .Port = tx.port,
+                },
+                .TxPower = tx.tx_power,
+                .Channel = tx.channel,
+            };
+            OnTxData( &params );
+            return true;
+        }
+
+        case LORAWAN_TRACE_CB_BEACON_STATUS: {
+            struct lorawan_trace_beacon_s beacon;
+            if (!hasData || rec->aux < sizeof(beacon)) { return false; }
+            memcpy(&beacon, data, sizeof(beacon));
+            LoRaMacHandlerBeaconParams_t params =
+            {
+                .State = beacon.state,
+                .Info =
+                {
+                    .Time = { .Seconds = rec->arg },
+                    .Frequency = beacon.frequency,
+                    .Datarate = beacon.datarate,
+                    .Rssi = beacon.rssi,
+                    .Snr = beacon.snr,
+                },
+            };
+            OnBeaconStatusChange( &params );
+            return true;
+        }
+
+        case LORAWAN_TRACE_CB_SYS_TIME_UPDATE:
+#if( LMH_SYS_TIME_UPDATE_NEW_API == 1 )
+            OnSysTimeUpdate( rec->aux != 0, (int32_t) rec->arg );
+#else
+            OnSysTimeUpdate( );
+#endif
+            return true;
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
+        case LORAWAN_TRACE_CB_FRAG_PROGRESS: {
+            uint16_t fragParams[4];
+            if (!hasData || rec->aux < sizeof(fragParams)) { return false; }
+            memcpy(fragParams, data, sizeof(fragParams));
+            OnFragProgress( fragParams[0], fragParams[1], fragParams[2], fragParams[3] );
+            return true;
+        }
+
+        case LORAWAN_TRACE_CB_FRAG_DONE:
+            if (rec->arg > UNFRAGMENTED_DATA_SIZE) { return false; }
+#if( FRAG_DECODER_FILE_HANDLING_NEW_API == 1 )
+            OnFragDone( (int16_t) rec->aux, rec->arg );
+#else
+            OnFragDone( (int16_t) rec->aux, UnfragmentedData, rec->arg );
+#endif
+            return true;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_PACKAGE_FRAGMENTATION
+
+        default:
+            //  Join, Class Change, NVM, Network Parameters and MAC Requests
+            //  come from the MAC, which is not replayed
+            return false;
+    }
+}
+
+/// Run the Event Handler for the Event Kind, like the Event Loop
+static void replay_event(uint8_t kind) {
+    switch (kind) {
+        case LORAWAN_TRACE_EV_TX_TIMER:
+            ble_npl_event_run(&replay_timer_event);
+            break;
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+        case LORAWAN_TRACE_EV_RX_FRAME:
+            //  Dispatch the Frames queued by the replayed RX Data Callbacks
+            ble_npl_event_run(&rx_frame_event);
+            break;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_RXPOOL
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+        case LORAWAN_TRACE_EV_MEM_REPORT:
+            handle_mem_report_event(NULL);
+            break;
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_MEMSTAT
+
+        default:
+            //  Radio IRQs and MAC Timers are handled by the MAC, which is not replayed.
+            //  Their outcome is replayed through the Callbacks.
+            break;
+    }
+}
+
+/// Handle a Trace Record at the recorded time
+static void handle_trace_record(const struct lorawan_trace_rec_s *rec, const uint8_t *data) {
+    switch (rec->type & ~LORAWAN_TRACE_HAS_DATA) {
+        case LORAWAN_TRACE_EVENT_DEQUEUE:
+            replay_busy = 0;
+            break;
+
+        case LORAWAN_TRACE_EVENT_KIND: {
+            //  Run the Event Handler before the Callbacks of the iteration, like the Event Loop
+            uint32_t start = lorawan_trace_now();
+            replay_event(rec->sub);
+            replay_busy += lorawan_trace_now() - start;
+            break;
+        }
+
+        case LORAWAN_TRACE_CALLBACK: {
+            //  Time only the application handler, not the wait for the next Record
+            uint32_t start = lorawan_trace_now();
+            bool replayed = replay_callback(rec, data);
+            replay_busy += lorawan_trace_now() - start;
+            if (replayed) { replay_callbacks++; } else { skipped_callbacks++; }
+            break;
         }
-        CRITICAL_SECTION_END( );
+
+        case LORAWAN_TRACE_LOOP_DONE: {
+            uint8_t kind = (rec->sub < LORAWAN_TRACE_NUM_EVENTS) ? rec->sub : LORAWAN_TRACE_EV_MAC;
+
+            //  The uplink and MAC processing are not replayed
+            IsTxFramePending = 0;
+            IsMacProcessPending = 0;
+
+            struct replay_stats_s *stats = &replay_stats[kind];
+            stats->loops++;
+            stats->latency += replay_busy;
+            if (replay_busy > stats->latency_max) { stats->latency_max = replay_busy; }
+            recorded_loops++;
+            recorded_latency += rec->arg;
+            if (rec->arg > recorded_latency_max) { recorded_latency_max = rec->arg; }
+            replay_busy = 0;
+            break;
+        }
+
+        default:
+            //  Timer fires are replayed through the Event Kinds. Radio IRQs go to the MAC.
+            break;
     }
 }
 
+/// Replay the Trace File through the application handlers and print the Event Loop
+/// latency for each Event Kind. Called before LmHandlerInit: the MAC, Radio and Event Queue
+/// are not used, so compare the replay of the same Trace File between builds, not against
+/// the recorded latency.
+static void replay_trace(void) {
+    memset(replay_stats, 0, sizeof(replay_stats));
+    ble_npl_event_init(
+        &replay_timer_event,  //  Event
+        OnTxTimerEvent,       //  Event Handler Function
+        NULL                  //  Argument to be passed to Event Handler
+    );
+
+    IsTraceReplay = true;
+    int count = lorawan_trace_replay(CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_FILE, handle_trace_record);
+    IsTraceReplay = false;
+    if (count < 0 || recorded_loops == 0) { return; }
+
+    printf("replay_trace: callbacks replayed=%lu, not replayed=%lu (from the MAC)\n",
+        replay_callbacks, skipped_callbacks);
+    for (int i = 0; i < LORAWAN_TRACE_NUM_EVENTS; i++) {
+        const struct replay_stats_s *stats = &replay_stats[i];
+        if (stats->loops == 0) { continue; }
+        printf("{\"event\":\"%s\",\"loops\":%lu,\"latency_mean_us\":%lu,\"latency_max_us\":%lu}\n",
+            replay_event_names[i], stats->loops,
+            (uint32_t) (stats->latency / stats->loops), stats->latency_max);
+    }
+
+    //  The recorded latency includes the MAC, Radio, SPI and Crypto work, which is not replayed
+    printf("replay_trace: recorded loop latency mean=%lu us, max=%lu us (includes MAC and radio)\n",
+        (uint32_t) (recorded_latency / recorded_loops), recorded_latency_max);
+}
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_REPLAY
+
 #ifdef NOTUSED
 ///////////////////////////////////////////////////////////////////////////////
 //  Test Event
@@ -0,0 +1,146 @@
+//  Synced Timekeeping for LoRaWAN Test App.
+//  The Clock Sync corrections are whole seconds, so the drift is estimated
+//  from the sum of the corrections over the time since the first sync, which
+//  gets more precise as the syncs are spread further apart.
+#include <nuttx/config.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include "lorawan_time.h"
+
+/// Time sync state and statistics
+struct time_sync_s {
+    uint32_t max_error_ms;    //  Predicted time error that triggers a resync (milliseconds)
+    uint32_t tolerance_ppb;   //  Oscillator tolerance before the drift is measured (parts per billion)
+    uint32_t syncs;           //  Number of time syncs
+    uint64_t base_gps_ms;     //  GPS time at the last sync (milliseconds)
+    uint64_t base_local_us;   //  Local time at the last sync (microseconds)
+    uint64_t first_local_us;  //  Local time at the first sync (microseconds)
+    int64_t  correction_sum;  //  Sum of the corrections after the first sync (seconds)
+    int32_t  drift_ppb;       //  Drift of the local oscillator, positive if fast (parts per billion)
+    uint32_t error_ppb;       //  Uncertainty of the drift (parts per billion)
+    int32_t  last_correction; //  Last correction (seconds)
+    uint32_t max_interval;    //  Longest interval between syncs (seconds)
+};
+
+static struct time_sync_s time_sync;
+
+/// Clear the time sync. "max_error_ms" is the predicted time error that triggers a resync,
+/// "drift_ppm" is the oscillator tolerance assumed until the drift has been measured.
+/// Returns -EINVAL if "max_error_ms" doesn't exceed LORAWAN_TIME_SYNC_RESIDUAL.
+int lorawan_time_init(uint32_t max_error_ms, uint32_t drift_ppm) {
+    //  Every sync leaves the residual, so a smaller threshold would resync on every uplink
+    if (max_error_ms <= LORAWAN_TIME_SYNC_RESIDUAL) { return -EINVAL; }
+    memset(&time_sync, 0, sizeof(time_sync));
+    time_sync.max_error_ms  = max_error_ms;
+    time_sync.tolerance_ppb = drift_ppm * 1000;
+    time_sync.error_ppb     = time_sync.tolerance_ppb;
+    return 0;
+}
+
+/// Return the local monotonic time in microseconds
+uint64_t lorawan_time_local(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// Record a time sync at the local time "local_us" (microseconds): "gps_ms" is the
+/// corrected GPS time (milliseconds) and "correction" is the correction applied (seconds)
+void lorawan_time_sync(uint64_t gps_ms, int32_t correction, uint64_t local_us) {
+    //  The first correction sets the clock, the later corrections measure the drift
+    if (time_sync.syncs == 0) {
+        time_sync.first_local_us = local_us;
+    } else {
+        uint32_t interval = (uint32_t) ((local_us - time_sync.base_local_us) / 1000000);
+        if (interval > time_sync.max_interval) { time_sync.max_interval = interval; }
+        time_sync.correction_sum += correction;
+
+        //  A fast oscillator is corrected backwards. The clock is left up to the residual
+        //  off after the first and the last sync, and the Clock Sync answer is delayed
+        //  by the network, so the drift is taken as uncertain by 2 seconds over the span.
+        //  The drift is measured when its uncertainty is below the tolerance.
+        //  Until then, the drift is not compensated and is bounded by the tolerance.
+        int64_t span_ms = (int64_t) ((local_us - time_sync.first_local_us) / 1000);
+        int64_t error_ppb = (span_ms > 0) ? 2000000000000LL / span_ms : INT64_MAX;
+        if (error_ppb < time_sync.tolerance_ppb) {
+            time_sync.drift_ppb = (int32_t) (-time_sync.correction_sum * 1000000000000LL / span_ms);
+            time_sync.error_ppb = (uint32_t) error_ppb;
+        }
+    }
+    time_sync.base_gps_ms     = gps_ms;
+    time_sync.base_local_us   = local_us;
+    time_sync.last_correction = correction;
+    time_sync.syncs++;
+}
+
+/// Return true if the time has been synced
+bool lorawan_time_synced(void) {
+    return time_sync.syncs > 0;
+}
+
+/// Return the GPS time (milliseconds) at the local time "local_us" (microseconds),
+/// compensated for the drift. Returns 0 if the time has not been synced.
+uint64_t lorawan_time_gps(uint64_t local_us) {
+    if (time_sync.syncs == 0) { return 0; }
+    int64_t elapsed_us = (int64_t) (local_us - time_sync.base_local_us);
+    elapsed_us -= elapsed_us / 1000 * time_sync.drift_ppb / 1000000;
+    return time_sync.base_gps_ms + elapsed_us / 1000;
+}
+
+/// Return the current GPS time in milliseconds, or 0 if the time has not been synced
+uint64_t lorawan_time_now(void) {
+    return lorawan_time_gps(lorawan_time_local());
+}
+
+/// Return the predicted time error (milliseconds) at the local time "local_us" (microseconds):
+/// the residual of the last sync, plus the error that grows with the uncertainty of the drift.
+uint32_t lorawan_time_error(uint64_t local_us) {
+    if (time_sync.syncs == 0) { return UINT32_MAX; }
+    uint64_t elapsed_ms = (local_us - time_sync.base_local_us) / 1000;
+    uint64_t error_ms = LORAWAN_TIME_SYNC_RESIDUAL + elapsed_ms * time_sync.error_ppb / 1000000000;
+    return (error_ms > UINT32_MAX) ? UINT32_MAX : (uint32_t) error_ms;
+}
+
+/// Return true if a resync is needed at the local time "local_us" (microseconds):
+/// the time has not been synced, or the predicted time error exceeds the threshold
+bool lorawan_time_resync_due(uint64_t local_us) {
+    return lorawan_time_error(local_us) > time_sync.max_error_ms;
+}
+
+/// Encode the GPS timestamps "stamps" (milliseconds) as a GPS base in seconds followed by
+/// 16-bit offsets in LORAWAN_TIME_OFFSET_UNIT, all little endian. Returns the number of bytes
+/// written, -E2BIG if "buf" is too small, or -ERANGE if a timestamp is out of range of the base.
+int lorawan_time_encode(uint8_t *buf, size_t size, const uint64_t *stamps, int count) {
+    assert(buf != NULL);
+    assert(stamps != NULL && count > 0);
+    int len = LORAWAN_TIME_BASE_SIZE + 2 * count;
+    if (size < len) { return -E2BIG; }
+
+    //  Base is the first timestamp, rounded down to the second
+    uint32_t base = (uint32_t) (stamps[0] / 1000);
+    uint64_t base_ms = (uint64_t) base * 1000;
+    buf[0] = base;
+    buf[1] = base >> 8;
+    buf[2] = base >> 16;
+    buf[3] = base >> 24;
+
+    for (int i = 0; i < count; i++) {
+        if (stamps[i] < base_ms) { return -ERANGE; }
+        uint64_t offset = (stamps[i] - base_ms) / LORAWAN_TIME_OFFSET_UNIT;
+        if (offset > UINT16_MAX) { return -ERANGE; }
+        buf[LORAWAN_TIME_BASE_SIZE + 2 * i]     = offset;
+        buf[LORAWAN_TIME_BASE_SIZE + 2 * i + 1] = offset >> 8;
+    }
+    return len;
+}
+
+/// Print the time sync statistics as one line of JSON
+void lorawan_time_report(void) {
+    printf("{\"syncs\":%lu,\"last_correction_s\":%ld,\"drift_ppb\":%ld,\"error_ppb\":%lu,"
+        "\"max_interval_s\":%lu,\"max_error_ms\":%lu}\n",
+        time_sync.syncs, (long) time_sync.last_correction, (long) time_sync.drift_ppb,
+        time_sync.error_ppb, time_sync.max_interval, time_sync.max_error_ms);
+}
@@ -0,0 +1,74 @@
+//  Synced Timekeeping for LoRaWAN Test App.
+//  Keeps GPS-epoch time from the Clock Sync corrections, estimates the drift
+//  of the local oscillator between syncs, and predicts the time error so that
+//  a resync is requested only when the error exceeds a threshold. Samples are
+//  stamped with lorawan_time_now() and sent as 16-bit offsets against one
+//  GPS-epoch base, instead of an absolute timestamp per sample.
+#ifndef __LORAWAN_TIME_H__
+#define __LORAWAN_TIME_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <nuttx/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Seconds between the Unix epoch and the GPS epoch (1980-01-06), ignoring leap seconds like LoRaMac
+#define LORAWAN_TIME_GPS_EPOCH_OFFSET  315964800
+
+/// Unit of the encoded sample offsets in milliseconds. 16-bit offsets cover 109 minutes.
+#define LORAWAN_TIME_OFFSET_UNIT  100
+
+/// Size of the encoded base in bytes: GPS time in seconds, little endian
+#define LORAWAN_TIME_BASE_SIZE  4
+
+/// Time error left after a sync in milliseconds: the Clock Sync corrections are
+/// whole seconds, so the clock may still be off by half a second
+#define LORAWAN_TIME_SYNC_RESIDUAL  500
+
+/// Clear the time sync. "max_error_ms" is the predicted time error that triggers a resync,
+/// "drift_ppm" is the oscillator tolerance assumed until the drift has been measured.
+/// Returns -EINVAL if "max_error_ms" doesn't exceed LORAWAN_TIME_SYNC_RESIDUAL.
+int lorawan_time_init(uint32_t max_error_ms, uint32_t drift_ppm);
+
+/// Return the local monotonic time in microseconds
+uint64_t lorawan_time_local(void);
+
+/// Record a time sync at the local time "local_us" (microseconds): "gps_ms" is the
+/// corrected GPS time (milliseconds) and "correction" is the correction applied (seconds)
+void lorawan_time_sync(uint64_t gps_ms, int32_t correction, uint64_t local_us);
+
+/// Return true if the time has been synced
+bool lorawan_time_synced(void);
+
+/// Return the GPS time (milliseconds) at the local time "local_us" (microseconds),
+/// compensated for the drift. Returns 0 if the time has not been synced.
+uint64_t lorawan_time_gps(uint64_t local_us);
+
+/// Return the current GPS time in milliseconds, or 0 if the time has not been synced
+uint64_t lorawan_time_now(void);
+
+/// Return the predicted time error (milliseconds) at the local time "local_us" (microseconds):
+/// the residual of the last sync, plus the error that grows with the uncertainty of the drift.
+uint32_t lorawan_time_error(uint64_t local_us);
+
+/// Return true if a resync is needed at the local time "local_us" (microseconds):
+/// the time has not been synced, or the predicted time error exceeds the threshold
+bool lorawan_time_resync_due(uint64_t local_us);
+
+/// Encode the GPS timestamps "stamps" (milliseconds) as a GPS base in seconds followed by
+/// 16-bit offsets in LORAWAN_TIME_OFFSET_UNIT, all little endian. Returns the number of bytes
+/// written, -E2BIG if "buf" is too small, or -ERANGE if a timestamp is out of range of the base.
+int lorawan_time_encode(uint8_t *buf, size_t size, const uint64_t *stamps, int count);
+
+/// Print the time sync statistics as one line of JSON
+void lorawan_time_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  //  __LORAWAN_TIME_H__
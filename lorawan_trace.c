@@ -0,0 +1,207 @@
+//  Event Trace Capture and Replay for LoRaWAN Test App.
+//  All Trace Points run on the lorawan_test task: on NuttX the Radio IRQs and
+//  Timer Callbacks are delivered through the NPL Event Queue, so no locking
+//  is needed. The buffer is written to the Trace File after the Event Loop
+//  iteration has been timed, unless it fills up within an iteration. Time
+//  spent writing the Trace File is excluded from the Event Loop latency.
+#include <nuttx/config.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "lorawan_trace.h"
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+
+/// Buffered Trace Records, appended to the Trace File when full
+static struct lorawan_trace_rec_s trace_buf[CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_RECORDS];
+
+/// Number of Trace Records in trace_buf
+static int trace_count = 0;
+
+/// Timestamp of the previous Trace Record (microseconds)
+static uint32_t trace_last = 0;
+
+/// Path of the Trace File, or NULL if not recording
+static const char *trace_path = NULL;
+
+/// Total time spent writing the Trace File (microseconds)
+static uint32_t trace_io = 0;
+
+/// Start time, Trace File write time at start, and Event Kind of the current Event Loop iteration
+static uint32_t loop_start = 0;
+static uint32_t loop_io = 0;
+static uint8_t loop_kind = LORAWAN_TRACE_EV_MAC;
+
+/// Number of Trace Records used by "len" bytes of data
+#define DATA_RECORDS(len)  (((len) + sizeof(struct lorawan_trace_rec_s) - 1) / sizeof(struct lorawan_trace_rec_s))
+
+/// Return the current monotonic time in microseconds
+uint32_t lorawan_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// Create the Trace File and start recording. Returns 0 if successful.
+int lorawan_trace_start(const char *path) {
+    assert(path != NULL);
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) { printf("lorawan_trace_start: Can't create %s\n", path); return -errno; }
+
+    //  Write the Trace File Header
+    const struct lorawan_trace_hdr_s hdr = {
+        .magic    = LORAWAN_TRACE_MAGIC,
+        .version  = LORAWAN_TRACE_VERSION,
+        .rec_size = sizeof(struct lorawan_trace_rec_s),
+    };
+    size_t written = fwrite(&hdr, sizeof(hdr), 1, fp);
+    fclose(fp);
+    if (written != 1) { return -EIO; }
+
+    printf("lorawan_trace_start: Recording to %s\n", path);
+    trace_path  = path;
+    trace_count = 0;
+    trace_io    = 0;
+    trace_last  = lorawan_trace_now();
+    return 0;
+}
+
+/// Append a Trace Record followed by "records" Trace Records of data.
+/// Returns the first data Record.
+static struct lorawan_trace_rec_s *append(uint8_t type, uint8_t sub, uint16_t aux, uint32_t arg, int records) {
+    //  If the buffer is full, append to the Trace File now
+    if (trace_count + 1 + records > CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_RECORDS) {
+        lorawan_trace_flush();
+    }
+
+    //  Store the time since the previous Trace Record
+    uint32_t now = lorawan_trace_now();
+    struct lorawan_trace_rec_s *rec = &trace_buf[trace_count];
+    rec->delta = now - trace_last;
+    rec->arg   = arg;
+    rec->type  = type;
+    rec->sub   = sub;
+    rec->aux   = aux;
+    trace_last = now;
+    trace_count += 1 + records;
+    return rec + 1;
+}
+
+/// Append a Trace Record. Flushes to the Trace File only if the buffer is full.
+void lorawan_trace(uint8_t type, uint8_t sub, uint16_t aux, uint32_t arg) {
+    if (trace_path == NULL) { return; }
+    append(type, sub, aux, arg, 0);
+}
+
+/// Append a Callback Trace Record followed by "len" bytes of data
+void lorawan_trace_data(uint8_t sub, uint32_t arg, const void *data, uint16_t len) {
+    if (trace_path == NULL) { return; }
+    assert(data != NULL || len == 0);
+    if (len > LORAWAN_TRACE_DATA_MAX) { len = LORAWAN_TRACE_DATA_MAX; }
+
+    //  Copy the data into the Records after the Callback Record, padded with zeros
+    int records = DATA_RECORDS(len);
+    uint8_t *buf = (uint8_t *) append(LORAWAN_TRACE_CALLBACK | LORAWAN_TRACE_HAS_DATA, sub, len, arg, records);
+    memset(buf, 0, records * sizeof(struct lorawan_trace_rec_s));
+    memcpy(buf, data, len);
+}
+
+/// Start timing an Event Loop iteration: record the Event dequeue and
+/// assume a MAC Event until lorawan_trace_kind is called
+void lorawan_trace_loop_start(void) {
+    if (trace_path == NULL) { return; }
+    append(LORAWAN_TRACE_EVENT_DEQUEUE, 0, 0, 0, 0);
+    loop_kind  = LORAWAN_TRACE_EV_MAC;
+    loop_io    = trace_io;
+    loop_start = lorawan_trace_now();
+}
+
+/// Record the kind of the Event being handled: enum lorawan_trace_event_e.
+/// Called at the start of the Event Handler, before any Callbacks.
+void lorawan_trace_kind(uint8_t kind) {
+    if (trace_path == NULL) { return; }
+    append(LORAWAN_TRACE_EVENT_KIND, kind, 0, 0, 0);
+    loop_kind = kind;
+}
+
+/// Record the Event Loop latency, excluding the time spent writing the Trace File.
+/// Then append the buffer to the Trace File if it's nearly full.
+void lorawan_trace_loop_done(void) {
+    if (trace_path == NULL) { return; }
+    uint32_t latency = lorawan_trace_now() - loop_start - (trace_io - loop_io);
+    append(LORAWAN_TRACE_LOOP_DONE, loop_kind, 0, latency, 0);
+
+    //  Leave room for the Records of the next iteration, including a Payload
+    if (trace_count + 2 * (1 + DATA_RECORDS(LORAWAN_TRACE_DATA_MAX)) > CONFIG_EXAMPLES_LORAWAN_TEST_TRACE_RECORDS) {
+        lorawan_trace_flush();
+    }
+}
+
+/// Append the buffered Trace Records to the Trace File. Returns 0 if successful.
+int lorawan_trace_flush(void) {
+    if (trace_path == NULL || trace_count == 0) { return 0; }
+
+    uint32_t start = lorawan_trace_now();
+    FILE *fp = fopen(trace_path, "ab");
+    if (fp == NULL) { return -errno; }
+    size_t written = fwrite(trace_buf, sizeof(trace_buf[0]), trace_count, fp);
+    fclose(fp);
+
+    int rc = (written == (size_t) trace_count) ? 0 : -EIO;
+    if (rc < 0) { printf("lorawan_trace_flush: Failed to write %s\n", trace_path); }
+    trace_count = 0;
+    trace_io += lorawan_trace_now() - start;
+    return rc;
+}
+
+/// Replay the Trace File by calling the handler for each Trace Record at the
+/// recorded time. Returns the number of Trace Records replayed, or negative errno.
+int lorawan_trace_replay(const char *path, lorawan_trace_handler_t handler) {
+    assert(path != NULL && handler != NULL);
+    printf("lorawan_trace_replay: Replaying %s\n", path);
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) { printf("lorawan_trace_replay: Can't open %s\n", path); return -errno; }
+
+    //  Validate the Trace File Header
+    struct lorawan_trace_hdr_s hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        hdr.magic    != LORAWAN_TRACE_MAGIC ||
+        hdr.version  != LORAWAN_TRACE_VERSION ||
+        hdr.rec_size != sizeof(struct lorawan_trace_rec_s)) {
+        printf("lorawan_trace_replay: Invalid trace file %s\n", path);
+        fclose(fp);
+        return -EINVAL;
+    }
+
+    //  Schedule each Trace Record relative to the start of replay, so that
+    //  time spent in the handler doesn't accumulate as drift
+    struct lorawan_trace_rec_s rec;
+    static uint8_t data[DATA_RECORDS(LORAWAN_TRACE_DATA_MAX) * sizeof(struct lorawan_trace_rec_s)];
+    uint32_t start = lorawan_trace_now();
+    uint32_t due = 0;
+    int count = 0;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        //  Read the data after the Record
+        if (rec.type & LORAWAN_TRACE_HAS_DATA) {
+            int records = DATA_RECORDS(rec.aux);
+            if (rec.aux > LORAWAN_TRACE_DATA_MAX || fread(data, sizeof(rec), records, fp) != records) {
+                printf("lorawan_trace_replay: Truncated data in %s\n", path);
+                break;
+            }
+        }
+        due += rec.delta;
+        int32_t wait = (int32_t) (due - (lorawan_trace_now() - start));
+        if (wait > 0) { usleep(wait); }
+
+        handler(&rec, data);
+        count++;
+    }
+    fclose(fp);
+    printf("lorawan_trace_replay: Replayed %d records\n", count);
+    return count;
+}
+
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
@@ -0,0 +1,170 @@
+//  Event Trace Capture and Replay for LoRaWAN Test App.
+//  Records NPL Event dequeues (with the kind of Event), Timer fires, Radio IRQs
+//  (via MAC Process Notify) and LmHandler Callbacks (with their parameters and
+//  payloads) into a compact binary buffer, which is appended to a Trace File
+//  at the end of an Event Loop iteration when the buffer is nearly full. The
+//  Trace File may be replayed (e.g. on NuttX sim:nsh under Linux) to feed the
+//  recorded inputs through the application handlers with the recorded timing.
+#ifndef __LORAWAN_TRACE_H__
+#define __LORAWAN_TRACE_H__
+
+#include <stdint.h>
+#include <nuttx/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Magic number at the start of the Trace File: "LWTR"
+#define LORAWAN_TRACE_MAGIC    0x5254574c
+
+/// Version of the Trace File format
+#define LORAWAN_TRACE_VERSION  3
+
+/// Maximum data bytes after a Trace Record
+#define LORAWAN_TRACE_DATA_MAX  256
+
+/// Flag in the Record Type: the Record is followed by "aux" bytes of data,
+/// padded to a multiple of the Record Size
+#define LORAWAN_TRACE_HAS_DATA  0x80
+
+/// Types of Trace Records
+enum lorawan_trace_type_e {
+    LORAWAN_TRACE_EVENT_DEQUEUE = 1,  //  NPL Event dequeued
+    LORAWAN_TRACE_LOOP_DONE,          //  Event Loop iteration done. sub = Event Kind, arg = Latency (microseconds)
+    LORAWAN_TRACE_TIMER_FIRE,         //  TxTimer fired. arg = TxPeriodicity (milliseconds)
+    LORAWAN_TRACE_RADIO_IRQ,          //  Radio IRQ or MAC Timer notified the MAC via OnMacProcessNotify.
+                                      //  LmHandler doesn't pass the IRQ source: the outcome is
+                                      //  recorded by the Join, TX Data and RX Data Callbacks.
+    LORAWAN_TRACE_CALLBACK,           //  LmHandler Callback. sub = Callback ID, arg = Callback-specific value
+    LORAWAN_TRACE_EVENT_KIND,         //  Event Handler started, before its Callbacks. sub = Event Kind
+};
+
+/// Kinds of NPL Events, stored in the "sub" field of LORAWAN_TRACE_EVENT_KIND and LORAWAN_TRACE_LOOP_DONE
+enum lorawan_trace_event_e {
+    LORAWAN_TRACE_EV_MAC = 0,     //  Radio IRQ or MAC Timer Event from liblorawan
+    LORAWAN_TRACE_EV_TX_TIMER,    //  TxTimer Event
+    LORAWAN_TRACE_EV_RX_FRAME,    //  Event to dispatch the queued Downlink Frames
+    LORAWAN_TRACE_EV_MEM_REPORT,  //  Event to report the RAM and Stack Usage
+    LORAWAN_TRACE_NUM_EVENTS
+};
+
+/// LmHandler Callback IDs, stored in the "sub" field of LORAWAN_TRACE_CALLBACK
+enum lorawan_trace_callback_e {
+    LORAWAN_TRACE_CB_NVM_DATA_CHANGE = 1,
+    LORAWAN_TRACE_CB_NETWORK_PARAMS,
+    LORAWAN_TRACE_CB_MCPS_REQUEST,
+    LORAWAN_TRACE_CB_MLME_REQUEST,
+    LORAWAN_TRACE_CB_JOIN_REQUEST,
+    LORAWAN_TRACE_CB_TX_DATA,
+    LORAWAN_TRACE_CB_RX_DATA,
+    LORAWAN_TRACE_CB_CLASS_CHANGE,
+    LORAWAN_TRACE_CB_BEACON_STATUS,
+    LORAWAN_TRACE_CB_SYS_TIME_UPDATE,
+    LORAWAN_TRACE_CB_FRAG_PROGRESS,
+    LORAWAN_TRACE_CB_FRAG_DONE,
+};
+
+/// Trace Record (12 bytes), written to the Trace File as-is (little endian)
+struct lorawan_trace_rec_s {
+    uint32_t delta;  //  Microseconds elapsed since the previous Trace Record
+    uint32_t arg;    //  Record-specific argument
+    uint8_t  type;   //  Record Type: enum lorawan_trace_type_e
+    uint8_t  sub;    //  Record Subtype: enum lorawan_trace_callback_e for Callbacks
+    uint16_t aux;    //  Record-specific auxiliary value
+};
+
+/// Data of LORAWAN_TRACE_CB_RX_DATA, followed by the Payload. arg = Downlink Counter.
+struct lorawan_trace_rx_s {
+    uint8_t port;       //  Application Port
+    uint8_t indication; //  IsMcpsIndication
+    uint8_t status;     //  Event Info Status
+    int8_t  datarate;   //  Datarate
+    int8_t  rssi;       //  RSSI in dBm
+    int8_t  snr;        //  SNR in dB
+    int8_t  rx_slot;    //  Receive Slot
+    uint8_t reserved;
+};
+
+/// Data of LORAWAN_TRACE_CB_TX_DATA, followed by the Payload. arg = Uplink Counter.
+struct lorawan_trace_tx_s {
+    uint8_t port;       //  Application Port
+    uint8_t confirm;    //  IsMcpsConfirm
+    uint8_t status;     //  Event Info Status
+    uint8_t msg_type;   //  Unconfirmed or Confirmed
+    uint8_t ack;        //  AckReceived
+    int8_t  datarate;   //  Datarate
+    int8_t  tx_power;   //  TX Power
+    uint8_t channel;    //  Channel
+};
+
+/// Data of LORAWAN_TRACE_CB_BEACON_STATUS. arg = GPS time of the Beacon (seconds).
+struct lorawan_trace_beacon_s {
+    uint32_t frequency; //  Frequency in Hz
+    int16_t  rssi;      //  RSSI in dBm
+    uint8_t  state;     //  Beacon State
+    uint8_t  datarate;  //  Datarate
+    int8_t   snr;       //  SNR in dB
+    uint8_t  reserved[3];
+};
+
+/// Header at the start of the Trace File
+struct lorawan_trace_hdr_s {
+    uint32_t magic;     //  LORAWAN_TRACE_MAGIC
+    uint16_t version;   //  LORAWAN_TRACE_VERSION
+    uint16_t rec_size;  //  sizeof(struct lorawan_trace_rec_s)
+};
+
+/// Handler called by lorawan_trace_replay for each Trace Record, at the recorded time.
+/// "data" points to the "aux" bytes of data if the Record Type has LORAWAN_TRACE_HAS_DATA.
+typedef void (*lorawan_trace_handler_t)(const struct lorawan_trace_rec_s *rec, const uint8_t *data);
+
+#ifdef CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+
+/// Return the current monotonic time in microseconds
+uint32_t lorawan_trace_now(void);
+
+/// Create the Trace File and start recording. Returns 0 if successful.
+int lorawan_trace_start(const char *path);
+
+/// Append a Trace Record. Flushes to the Trace File only if the buffer is full.
+void lorawan_trace(uint8_t type, uint8_t sub, uint16_t aux, uint32_t arg);
+
+/// Append a Callback Trace Record followed by "len" bytes of data
+void lorawan_trace_data(uint8_t sub, uint32_t arg, const void *data, uint16_t len);
+
+/// Start timing an Event Loop iteration: record the Event dequeue and
+/// assume a MAC Event until lorawan_trace_kind is called
+void lorawan_trace_loop_start(void);
+
+/// Record the kind of the Event being handled: enum lorawan_trace_event_e.
+/// Called at the start of the Event Handler, before any Callbacks.
+void lorawan_trace_kind(uint8_t kind);
+
+/// Record the Event Loop latency, excluding the time spent writing the Trace File.
+/// Then append the buffer to the Trace File if it's nearly full.
+void lorawan_trace_loop_done(void);
+
+/// Append the buffered Trace Records to the Trace File. Returns 0 if successful.
+int lorawan_trace_flush(void);
+
+/// Replay the Trace File by calling the handler for each Trace Record at the
+/// recorded time. Returns the number of Trace Records replayed, or negative errno.
+int lorawan_trace_replay(const char *path, lorawan_trace_handler_t handler);
+
+#else
+
+//  Tracing is disabled: compile the Trace Points to nothing
+#define lorawan_trace(type, sub, aux, arg)
+#define lorawan_trace_data(sub, arg, data, len)
+#define lorawan_trace_loop_start()
+#define lorawan_trace_kind(kind)
+#define lorawan_trace_loop_done()
+
+#endif  //  CONFIG_EXAMPLES_LORAWAN_TEST_TRACE
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  //  __LORAWAN_TRACE_H__